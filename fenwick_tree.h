@@ -0,0 +1,80 @@
+// fenwick_tree.h
+// Prefix sums over a sequence of non-negative counts (a binary indexed tree). Setting one count and
+// summing the first n both cost O(log size), and find() locates the element a running total falls
+// in, e.g. the chunk holding a text position. Inserting or removing elements rebuilds the tree in
+// O(size), which suits the chunked indices (utf8.h, line_table.h, text_storage.h): their shape
+// only changes when a chunk splits or merges.
+
+#pragma once
+
+#include <vector>
+#include <bit>
+#include <cstddef>
+
+template <typename T>
+class FenwickTree {
+public:
+	explicit FenwickTree(size_t count = 0, T value = T()) : values(count, value) { rebuild(); }
+
+	size_t size() const { return values.size(); }
+	T value(size_t i) const { return values[i]; }
+
+	// Sum of the first count elements
+	T prefix(size_t count) const {
+		T sum = T();
+		for (size_t i = count; i > 0; i &= i - 1)
+			sum += tree[i];
+		return sum;
+	}
+
+	void set(size_t i, T value) {
+		const T delta = value - values[i];
+		values[i] = value;
+		for (size_t k = i + 1; k < tree.size(); k += k & (0 - k))
+			tree[k] += delta;
+	}
+
+	// The largest count with prefix(count) <= total: with total below the sum of all elements, the
+	// index of the element total falls in, zero elements before it skipped
+	size_t find(T total) const {
+		size_t at = 0;
+		for (size_t step = std::bit_floor(values.size()); step > 0; step >>= 1) {
+			if (at + step < tree.size() && tree[at + step] <= total) {
+				at += step;
+				total -= tree[at];
+			}
+		}
+		return at;
+	}
+
+	void push_back(T value) {
+		values.push_back(value);
+		const size_t i = values.size();
+		T sum = value;
+		for (size_t k = i - 1; k > i - (i & (0 - i)); k &= k - 1)
+			sum += tree[k];
+		tree.push_back(sum);
+	}
+
+	// Replaces elements [first, last) by [begin, end)
+	template <typename It>
+	void replace(size_t first, size_t last, It begin, It end) {
+		values.erase(values.begin() + first, values.begin() + last);
+		values.insert(values.begin() + first, begin, end);
+		rebuild();
+	}
+
+private:
+	void rebuild() {
+		tree.assign(values.size() + 1, T());
+		for (size_t i = 1; i < tree.size(); ++i) {
+			tree[i] += values[i - 1];
+			const size_t parent = i + (i & (0 - i));
+			if (parent < tree.size())
+				tree[parent] += tree[i];
+		}
+	}
+
+	std::vector<T> values;
+	std::vector<T> tree; // 1-based, tree[i] is the sum of values (i - lowest bit of i, i]
+};
@@ -0,0 +1,147 @@
+// frame_arena.h
+// Scratch memory for work that lives no longer than a frame: the spans and runs collected while
+// drawing, the flags of the tessellation jobs and the vertex data handed to bgfx::makeRef.
+//
+// Allocations are bumped out of chunks and never freed one by one; nextFrame(), called right after
+// bgfx::frame (see submit_frame), recycles them all at once. bgfx reads memory passed to makeRef up
+// to the frame after the one it was submitted in, so the arena has two regions used on alternate
+// frames and only resets the older one. A region that needed more than one chunk is merged into a
+// single chunk of the combined size when it is reset, so once the busiest frame has been seen the
+// arena does not allocate again. ArenaAllocator puts standard containers on top (FrameVector).
+// Main thread only.
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+
+class FrameArena {
+public:
+	FrameArena() = default;
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+	~FrameArena() {
+		for (Region& region : regions)
+			region.release();
+	}
+
+	void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t)) {
+		return regions[current].allocate(bytes, alignment);
+	}
+
+	// Uninitialized storage for count objects of type T
+	template <typename T>
+	T* allocate(size_t count) {
+		return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+	}
+
+	// Takes the bytes back if they are the last allocation, e.g. a vector that is about to grow again.
+	// Anything else stays allocated until its frame is over.
+	void deallocate(void* p, size_t bytes) { regions[current].deallocate(static_cast<char*>(p), bytes); }
+
+	// After bgfx::frame: everything allocated before the previous call becomes free.
+	void nextFrame() {
+		current ^= 1;
+		regions[current].reset();
+	}
+
+	size_t capacity() const { return regions[0].capacity + regions[1].capacity; }
+
+private:
+	static constexpr size_t MIN_CHUNK = 64 << 10;
+
+	struct alignas(std::max_align_t) Chunk {
+		Chunk* previous; // filled before this one, until the next reset
+		size_t size;     // bytes after the header
+
+		char* data() { return reinterpret_cast<char*>(this + 1); }
+	};
+
+	struct Region {
+		Chunk* chunk = nullptr;
+		size_t top = 0;      // first free byte of chunk
+		size_t capacity = 0; // bytes in all chunks
+
+		void* allocate(size_t bytes, size_t alignment) {
+			if (chunk) {
+				char* p = align(chunk->data() + top, alignment);
+				if ((size_t) (p - chunk->data()) + bytes <= chunk->size) {
+					top = (size_t) (p - chunk->data()) + bytes;
+					return p;
+				}
+			}
+			push(std::max({ bytes + alignment, MIN_CHUNK, capacity }));
+			char* p = align(chunk->data(), alignment);
+			top = (size_t) (p - chunk->data()) + bytes;
+			return p;
+		}
+
+		void deallocate(char* p, size_t bytes) {
+			if (!chunk)
+				return;
+			const uintptr_t begin = (uintptr_t) chunk->data();
+			if ((uintptr_t) p >= begin && (uintptr_t) p + bytes == begin + top)
+				top = (size_t) ((uintptr_t) p - begin);
+		}
+
+		void reset() {
+			if (chunk && chunk->previous) {
+				const size_t total = capacity;
+				release();
+				push(total);
+			}
+			top = 0;
+		}
+
+		void push(size_t size) {
+			Chunk* next = static_cast<Chunk*>(::operator new(sizeof(Chunk) + size));
+			next->previous = chunk;
+			next->size = size;
+			chunk = next;
+			capacity += size;
+			top = 0;
+		}
+
+		void release() {
+			while (chunk) {
+				Chunk* previous = chunk->previous;
+				::operator delete(chunk);
+				chunk = previous;
+			}
+			capacity = 0;
+			top = 0;
+		}
+
+		static char* align(char* p, size_t alignment) {
+			return reinterpret_cast<char*>(((uintptr_t) p + alignment - 1) & ~(uintptr_t) (alignment - 1));
+		}
+	};
+
+	Region regions[2];
+	unsigned current = 0;
+};
+
+// Standard allocator over a FrameArena. Containers using it must be gone, or at least never touched
+// again, once their frame is over.
+template <typename T>
+struct ArenaAllocator {
+	using value_type = T;
+
+	ArenaAllocator(FrameArena& arena) : arena(&arena) {}
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+	T* allocate(size_t count) { return arena->allocate<T>(count); }
+	void deallocate(T* p, size_t count) { arena->deallocate(p, count * sizeof(T)); }
+
+	template <typename U>
+	bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+
+	FrameArena* arena;
+};
+
+template <typename T>
+using FrameVector = std::vector<T, ArenaAllocator<T>>;
@@ -0,0 +1,419 @@
+// glyph_atlas.h
+// On-demand MSDF glyph atlas. The texture starts empty; a glyph is generated the first time it is
+// asked for and appears a frame or so later, so startup and the frame loop never wait on MSDF
+// generation and only the glyphs actually shown are ever paid for.
+//
+//   main thread   request(): load the outline from the font (FreeType is not thread-safe), queue it
+//   workers       edge colouring, box sizing and msdfGenerator into a private bitmap, one glyph per
+//                 worker at a time, as many workers as there are other cores
+//   main thread   pump(): place finished bitmaps on a shelf, mark ready, queue them for upload
+//   bgfx thread   upload(): bgfx::updateTexture2D of the queued bitmaps
+//
+// Packing runs on the main thread while the workers generate the next glyphs. Only upload() and
+// destroy() call bgfx, so an atlas can be set up on a loading thread and the uploads can run on a
+// render thread alongside pump(); the texture is created and the texels read() restored are
+// uploaded by the first upload(). Single-threaded, upload() simply follows pump().
+//
+// Records are keyed by codepoint and never move, so callers may keep pointers to them. write() and
+// read() save and restore the packed state (shelves, ready records and texels), which is what the
+// on-disk atlas cache is made of.
+
+#pragma once
+
+#include <msdf-atlas-gen/msdf-atlas-gen.h>
+#include <bgfx/bgfx.h>
+
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+// Raw binary I/O of trivially copyable values, for the atlas cache
+template <typename T>
+bool writeValues(std::FILE* file, const T* values, size_t count) {
+	return std::fwrite(values, sizeof(T), count, file) == count;
+}
+
+template <typename T>
+bool readValues(std::FILE* file, T* values, size_t count) {
+	return std::fread(values, sizeof(T), count, file) == count;
+}
+
+// Packs boxes into horizontal shelves: a box goes on the first shelf tall enough (and not much
+// taller) with room left, otherwise a new shelf is opened below the last one.
+class ShelfPacker {
+public:
+	void reset(int atlasWidth, int atlasHeight) {
+		width = atlasWidth;
+		height = atlasHeight;
+		bottom = 0;
+		shelves.clear();
+	}
+
+	bool allocate(int w, int h, int& x, int& y) {
+		for (Shelf& shelf : shelves) {
+			if (h <= shelf.height && 4 * h >= 3 * shelf.height && shelf.x + w <= width) {
+				x = shelf.x;
+				y = shelf.y;
+				shelf.x += w;
+				return true;
+			}
+		}
+
+		if (w > width || bottom + h > height)
+			return false;
+
+		shelves.push_back(Shelf { bottom, h, w });
+		x = 0;
+		y = bottom;
+		bottom += h;
+		return true;
+	}
+
+	bool write(std::FILE* file) const {
+		const uint32_t count = (uint32_t) shelves.size();
+		return writeValues(file, &bottom, 1) && writeValues(file, &count, 1) && writeValues(file, shelves.data(), count);
+	}
+
+	bool read(std::FILE* file) {
+		// Every shelf is at least one row tall, so a corrupt count fails here instead of allocating
+		uint32_t count = 0;
+		if (!readValues(file, &bottom, 1) || !readValues(file, &count, 1) || bottom < 0 || bottom > height || count > (uint32_t) height)
+			return false;
+		shelves.resize(count);
+		return readValues(file, shelves.data(), count);
+	}
+
+private:
+	struct Shelf {
+		int y, height;
+		int x; // first free column
+	};
+
+	std::vector<Shelf> shelves;
+	int width = 0;
+	int height = 0;
+	int bottom = 0;
+};
+
+struct AtlasGlyph {
+	enum class State : uint8_t {
+		Missing, // not requested yet
+		Queued,  // waiting for or being generated by the worker
+		Ready,   // bounds below are valid and the bitmap is in the texture
+		Failed,  // not in the font, or the atlas is full
+	};
+
+	float pl = 0.0f, pb = 0.0f, pr = 0.0f, pt = 0.0f; // plane bounds, font geometry units
+	float al = 0.0f, ab = 0.0f, ar = 0.0f, at = 0.0f; // atlas bounds, normalized
+	msdf_atlas::unicode_t codepoint = 0;
+	State state = State::Missing;
+};
+
+class GlyphAtlas {
+public:
+	static constexpr int SIZE = 1024; // texels, RGB8
+	static constexpr int SPACING = 1; // texel gutter between boxes against bilinear bleeding
+	// create() reserves an opaque SOLID x SOLID block in the corner, which the MSDF shader draws as a
+	// fully inside, i.e. solid vertex colour. A quad mapped onto [SOLID_UV0, SOLID_UV1] (the inner
+	// texels, which bilinear filtering keeps off the gutter) is a solid rectangle in every atlas.
+	static constexpr int SOLID = 4;
+	static constexpr float SOLID_UV0 = 1.0f / SIZE;
+	static constexpr float SOLID_UV1 = (SOLID - 1.0f) / SIZE;
+	static constexpr double MITER_LIMIT = 1.0;
+	static constexpr double CORNER_ANGLE = 3.0; // edge colouring threshold, radians
+
+	GlyphAtlas() = default;
+	GlyphAtlas(const GlyphAtlas&) = delete;
+	GlyphAtlas& operator=(const GlyphAtlas&) = delete;
+	~GlyphAtlas() { destroy(); }
+
+	// geometryScale converts font units to geometry units (FontGeometry::getGeometryScale()), scale
+	// is atlas pixels per geometry unit and pxRange the distance field range in pixels. font has to
+	// outlive the atlas. workers = 0 starts one generator per core but the calling thread's.
+	void create(msdfgen::FontHandle* font, double geometryScale, double scale, double pxRange, unsigned workers = 0) {
+		destroy();
+		this->font = font;
+		this->geometryScale = geometryScale;
+		attributes.scale = scale;
+		attributes.range = msdfgen::Range(pxRange / scale);
+		attributes.innerPadding = msdf_atlas::Padding();
+		attributes.outerPadding = msdf_atlas::Padding();
+		attributes.miterLimit = MITER_LIMIT;
+		attributes.pxAlignOriginX = false;
+		attributes.pxAlignOriginY = false;
+
+		packer.reset(SIZE, SIZE);
+		texels.assign((size_t) SIZE * SIZE * 3, 0);
+		uploadTexels = false;
+		uploads.clear();
+		uploadPixels.clear();
+		int x = 0, y = 0;
+		packer.allocate(SOLID + SPACING, SOLID + SPACING, x, y); // the first box, so always at (0, 0)
+		for (int row = 0; row < SOLID; ++row)
+			std::memset(&texels[(size_t) row * SIZE * 3], 0xff, SOLID * 3);
+		uploads.push_back(Upload { 0, 0, SOLID, SOLID, 0 });
+		uploadPixels.assign(SOLID * SOLID * 3, 0xff);
+		modified = false;
+		stopping = false;
+		if (workers == 0) {
+			const unsigned cores = std::thread::hardware_concurrency();
+			workers = cores > 1 ? cores - 1 : 1;
+		}
+		for (unsigned i = 0; i < workers; ++i)
+			this->workers.emplace_back([this] { workerLoop(); });
+	}
+
+	void destroy() {
+		if (!workers.empty()) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			for (std::thread& worker : workers)
+				worker.join();
+			workers.clear();
+		}
+		jobs.clear();
+		results.clear();
+		glyphs.clear();
+		texels.clear();
+		texels.shrink_to_fit();
+		uploads.clear();
+		uploadPixels.clear();
+		modified = false;
+		if (bgfx::isValid(texture)) bgfx::destroy(texture);
+		texture = BGFX_INVALID_HANDLE;
+		font = nullptr;
+	}
+
+	// Invalid until the first upload()
+	bgfx::TextureHandle getTexture() const { return texture; }
+
+	// Called on a worker thread when a glyph finishes and no other finished glyph is waiting for
+	// pump(), so a sleeping frame loop can be woken up. Set it before create().
+	void setNotify(std::function<void()> callback) { notify = std::move(callback); }
+
+	// True once glyphs were added since create() or read(), i.e. a saved copy is out of date
+	bool isModified() const { return modified; }
+
+	// The record for a codepoint, created in the Missing state. No generation is started.
+	AtlasGlyph* find(msdf_atlas::unicode_t codepoint) {
+		AtlasGlyph& glyph = glyphs[codepoint];
+		glyph.codepoint = codepoint;
+		return &glyph;
+	}
+
+	// Queues generation of a Missing glyph; does nothing in any other state.
+	void request(AtlasGlyph& glyph) {
+		if (glyph.state != AtlasGlyph::State::Missing)
+			return;
+
+		Job job;
+		job.glyph = &glyph;
+		if (!font || !job.geometry.load(font, geometryScale, glyph.codepoint)) {
+			glyph.state = AtlasGlyph::State::Failed;
+			return;
+		}
+
+		glyph.state = AtlasGlyph::State::Queued;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(std::move(job));
+		}
+		wake.notify_one();
+	}
+
+	// Places the glyphs the workers finished since the last call and queues them for upload().
+	// Returns true if any glyph became ready, i.e. text drawn without it has to be tessellated again;
+	// it shows once upload() has run, which has to happen before that text is drawn.
+	bool pump() {
+		if (texels.empty())
+			return false;
+
+		// The two vectors trade places, so both keep their capacity
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			finished.swap(results);
+		}
+
+		bool changed = false;
+		std::lock_guard<std::mutex> lock(uploadMutex);
+		for (Result& result : finished) {
+			AtlasGlyph& glyph = *result.glyph;
+			int x = 0, y = 0;
+			if (result.width > 0 && result.height > 0) {
+				if (!packer.allocate(result.width + SPACING, result.height + SPACING, x, y)) {
+					glyph.state = AtlasGlyph::State::Failed;
+					continue;
+				}
+				uploads.push_back(Upload { (uint16_t) x, (uint16_t) y, (uint16_t) result.width, (uint16_t) result.height, uploadPixels.size() });
+				uploadPixels.insert(uploadPixels.end(), result.pixels.begin(), result.pixels.end());
+
+				// CPU copy of the texture for write()
+				const size_t rowBytes = (size_t) result.width * 3;
+				for (int row = 0; row < result.height; ++row)
+					std::memcpy(&texels[((size_t) (y + row) * SIZE + x) * 3], &result.pixels[row * rowBytes], rowBytes);
+			}
+
+			result.geometry.placeBox(x, y);
+			double l, b, r, t;
+			result.geometry.getQuadPlaneBounds(l, b, r, t);
+			glyph.pl = (float) l, glyph.pb = (float) b, glyph.pr = (float) r, glyph.pt = (float) t;
+			result.geometry.getQuadAtlasBounds(l, b, r, t);
+			glyph.al = (float) (l / SIZE), glyph.ab = (float) (b / SIZE), glyph.ar = (float) (r / SIZE), glyph.at = (float) (t / SIZE);
+			glyph.state = AtlasGlyph::State::Ready;
+			changed = true;
+		}
+		finished.clear();
+		modified |= changed;
+		return changed;
+	}
+
+	// Creates the texture on the first call and uploads what pump() queued since the last one. Call
+	// it on the thread that owns bgfx, which may be another than pump()'s.
+	void upload() {
+		std::lock_guard<std::mutex> lock(uploadMutex);
+		if (texels.empty())
+			return;
+
+		if (!bgfx::isValid(texture)) {
+			texture = bgfx::createTexture2D(SIZE, SIZE, false, 1, bgfx::TextureFormat::RGB8);
+			if (uploadTexels)
+				bgfx::updateTexture2D(texture, 0, 0, 0, 0, SIZE, SIZE, bgfx::copy(texels.data(), (uint32_t) texels.size()));
+			uploadTexels = false;
+		}
+		for (const Upload& pending : uploads) {
+			const bgfx::Memory* memory = bgfx::copy(&uploadPixels[pending.offset], (uint32_t) pending.width * pending.height * 3);
+			bgfx::updateTexture2D(texture, 0, 0, pending.x, pending.y, pending.width, pending.height, memory);
+		}
+		uploads.clear();
+		uploadPixels.clear();
+	}
+
+	// Saves the shelves, the ready glyphs and the texels. Call after pump(), nothing in flight is kept.
+	bool write(std::FILE* file) const {
+		std::vector<AtlasGlyph> ready;
+		for (const auto& [codepoint, glyph] : glyphs) {
+			if (glyph.state == AtlasGlyph::State::Ready)
+				ready.push_back(glyph);
+		}
+		const uint32_t count = (uint32_t) ready.size();
+		return packer.write(file)
+			&& writeValues(file, &count, 1) && writeValues(file, ready.data(), count)
+			&& writeValues(file, texels.data(), texels.size());
+	}
+
+	// Restores what write() saved into a freshly created atlas; the next upload() uploads the whole
+	// texture at once. On failure the atlas is left half filled and has to be created again.
+	bool read(std::FILE* file) {
+		// More glyphs than texels cannot have been packed; a corrupt count fails here instead of
+		// allocating
+		uint32_t count = 0;
+		if (!packer.read(file) || !readValues(file, &count, 1) || count > (uint32_t) SIZE * SIZE)
+			return false;
+		std::vector<AtlasGlyph> ready(count);
+		if (!readValues(file, ready.data(), count) || !readValues(file, texels.data(), texels.size()))
+			return false;
+
+		for (const AtlasGlyph& glyph : ready) {
+			if (glyph.state == AtlasGlyph::State::Ready)
+				glyphs[glyph.codepoint] = glyph;
+		}
+		uploadTexels = true;
+		modified = false;
+		return true;
+	}
+
+private:
+	struct Job {
+		AtlasGlyph* glyph = nullptr;
+		msdf_atlas::GlyphGeometry geometry;
+	};
+
+	// A placed bitmap waiting for upload(), its pixels at offset in uploadPixels
+	struct Upload {
+		uint16_t x, y, width, height;
+		size_t offset;
+	};
+
+	struct Result {
+		AtlasGlyph* glyph = nullptr;
+		msdf_atlas::GlyphGeometry geometry; // box sized but not placed yet
+		int width = 0, height = 0;
+		std::vector<uint8_t> pixels; // RGB8, bottom row first like every msdfgen bitmap
+	};
+
+	void workerLoop() {
+		msdf_atlas::GeneratorAttributes generatorAttributes;
+		for (;;) {
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (stopping)
+					return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+
+			Result result;
+			result.glyph = job.glyph;
+			result.geometry = std::move(job.geometry);
+			result.geometry.edgeColoring(&msdfgen::edgeColoringInkTrap, CORNER_ANGLE, 0);
+			result.geometry.wrapBox(attributes);
+			result.geometry.getBoxSize(result.width, result.height);
+
+			if (result.width > 0 && result.height > 0) {
+				msdfgen::Bitmap<float, 3> bitmap(result.width, result.height);
+				msdf_atlas::msdfGenerator(bitmap, result.geometry, generatorAttributes);
+				result.pixels.resize((size_t) result.width * result.height * 3);
+				uint8_t* out = result.pixels.data();
+				for (int row = 0; row < result.height; ++row)
+					for (int column = 0; column < result.width; ++column)
+						for (int channel = 0; channel < 3; ++channel)
+							*out++ = msdfgen::pixelFloatToByte(bitmap(column, row)[channel]);
+			}
+
+			bool first = false;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				first = results.empty();
+				results.push_back(std::move(result));
+			}
+			if (first && notify)
+				notify();
+		}
+	}
+
+	msdfgen::FontHandle* font = nullptr;
+	double geometryScale = 1.0;
+	msdf_atlas::GlyphGeometry::GlyphAttributes attributes {};
+	bgfx::TextureHandle texture = BGFX_INVALID_HANDLE;
+	ShelfPacker packer;
+	std::unordered_map<msdf_atlas::unicode_t, AtlasGlyph> glyphs;
+	bool modified = false;
+
+	std::mutex uploadMutex;            // between pump() and upload()
+	std::vector<uint8_t> texels;       // mirror of the texture, bottom row first
+	bool uploadTexels = false;         // read() filled texels before there was a texture
+	std::vector<Upload> uploads;       // placed since the last upload()
+	std::vector<uint8_t> uploadPixels;
+
+	std::function<void()> notify;
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+	std::deque<Job> jobs;       // guarded by mutex
+	std::vector<Result> results; // guarded by mutex
+	std::vector<Result> finished; // taken from results by pump()
+};
@@ -0,0 +1,110 @@
+// heap_counter.h
+// Debug count of heap allocations, to check that steady-state typing and drawing allocate nothing.
+//
+// Counts three sources separately: the global operator new, SDL's allocator once
+// countSDLAllocations() has run (before SDL_Init) and bgfx's, when heapCountingAllocator() is
+// passed as bgfx::Init::allocator. It replaces the global operator new, so exactly one translation
+// unit includes it: main.cpp, for the benchmark (allocs/op) and with EDITING_COUNT_ALLOCATIONS,
+// which makes the F3 overlay show the allocations of every frame.
+
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <cstdint>
+
+#include <SDL3/SDL.h>
+#include <bx/allocator.h>
+
+struct HeapCounts {
+	uint64_t cpp = 0;  // operator new
+	uint64_t sdl = 0;  // SDL_malloc, SDL_calloc, SDL_realloc
+	uint64_t bgfx = 0; // bgfx's allocator, e.g. bgfx::alloc and bgfx::copy
+
+	uint64_t total() const { return cpp + sdl + bgfx; }
+
+	HeapCounts operator-(const HeapCounts& other) const {
+		return HeapCounts { cpp - other.cpp, sdl - other.sdl, bgfx - other.bgfx };
+	}
+};
+
+static std::atomic<uint64_t> g_HeapNew { 0 };
+static std::atomic<uint64_t> g_HeapSDL { 0 };
+static std::atomic<uint64_t> g_HeapBgfx { 0 };
+
+HeapCounts heapCounts() {
+	return HeapCounts { g_HeapNew.load(std::memory_order_relaxed), g_HeapSDL.load(std::memory_order_relaxed),
+		g_HeapBgfx.load(std::memory_order_relaxed) };
+}
+
+void* operator new(size_t size) {
+	g_HeapNew.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+void* operator new(size_t size, std::align_val_t alignment) {
+	g_HeapNew.fetch_add(1, std::memory_order_relaxed);
+	const size_t align = (size_t) alignment;
+#if defined(_MSC_VER)
+	if (void* p = _aligned_malloc(size ? size : 1, align))
+		return p;
+#else
+	// aligned_alloc wants a multiple of the alignment
+	if (void* p = std::aligned_alloc(align, ((size ? size : 1) + align - 1) / align * align))
+		return p;
+#endif
+	throw std::bad_alloc();
+}
+#if defined(_MSC_VER)
+void operator delete(void* p, std::align_val_t) noexcept { _aligned_free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { _aligned_free(p); }
+#else
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+#endif
+
+// Routes SDL's allocations through counters; has to run before SDL allocates anything.
+void countSDLAllocations() {
+	static SDL_malloc_func originalMalloc;
+	static SDL_calloc_func originalCalloc;
+	static SDL_realloc_func originalRealloc;
+	static SDL_free_func originalFree;
+	SDL_GetOriginalMemoryFunctions(&originalMalloc, &originalCalloc, &originalRealloc, &originalFree);
+	SDL_SetMemoryFunctions(
+		[](size_t size) -> void* {
+			g_HeapSDL.fetch_add(1, std::memory_order_relaxed);
+			return originalMalloc(size);
+		},
+		[](size_t count, size_t size) -> void* {
+			g_HeapSDL.fetch_add(1, std::memory_order_relaxed);
+			return originalCalloc(count, size);
+		},
+		[](void* p, size_t size) -> void* {
+			g_HeapSDL.fetch_add(1, std::memory_order_relaxed);
+			return originalRealloc(p, size);
+		},
+		originalFree);
+}
+
+// bx's default allocator with a counter on every allocation and reallocation
+class HeapCountingAllocator : public bx::AllocatorI {
+public:
+	void* realloc(void* p, size_t size, size_t align, const char* filePath, uint32_t line) override {
+		if (size != 0)
+			g_HeapBgfx.fetch_add(1, std::memory_order_relaxed);
+		return allocator.realloc(p, size, align, filePath, line);
+	}
+
+private:
+	bx::DefaultAllocator allocator;
+};
+
+bx::AllocatorI* heapCountingAllocator() {
+	static HeapCountingAllocator allocator;
+	return &allocator;
+}
@@ -0,0 +1,187 @@
+// job_pool.h
+// Fork-join worker pool for data-parallel loops on the main thread's behalf.
+//
+// parallelFor(count, grain, fn) splits [0, count) evenly between the caller and the workers. Each
+// participant takes grain-sized chunks from the front of its own range and, once that is empty,
+// steals the back half of the largest range left, so uneven chunks still keep every thread busy.
+// A range is one 64-bit atomic (begin << 32 | end); owner and thieves change it with CAS only.
+// The call returns when every chunk has run. Workers sleep between loops.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class JobPool {
+public:
+	JobPool() = default;
+	JobPool(const JobPool&) = delete;
+	JobPool& operator=(const JobPool&) = delete;
+	~JobPool() { stop(); }
+
+	// workers = 0 sizes the pool to the hardware, one thread per core besides the caller's.
+	void start(unsigned workers = 0) {
+		stop();
+		if (workers == 0) {
+			const unsigned cores = std::thread::hardware_concurrency();
+			workers = cores > 1 ? cores - 1 : 0;
+		}
+		ranges = std::make_unique<Range[]>(workers + 1);
+		participants = workers + 1;
+		stopping = false;
+		// No worker runs yet, so generation can be read without the lock
+		for (unsigned i = 0; i < workers; ++i)
+			threads.emplace_back([this, i, seen = generation] { workerLoop(i + 1, seen); });
+	}
+
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& thread : threads)
+			thread.join();
+		threads.clear();
+		participants = 1;
+	}
+
+	// Threads that run a parallelFor, the caller included
+	unsigned size() const { return participants; }
+
+	// Calls fn(uint32_t begin, uint32_t end) for chunks of at most grain indices covering
+	// [0, count), on the workers and the calling thread. Not reentrant.
+	template <typename Fn>
+	void parallelFor(uint32_t count, uint32_t grain, Fn&& fn) {
+		if (count == 0)
+			return;
+		if (participants == 1 || count <= grain) {
+			fn(0u, count);
+			return;
+		}
+
+		using Task = std::remove_reference_t<Fn>;
+		task = [](void* context, uint32_t begin, uint32_t end) { (*static_cast<Task*>(context))(begin, end); };
+		taskContext = const_cast<void*>(static_cast<const void*>(&fn));
+		taskGrain = grain > 0 ? grain : 1;
+		for (unsigned i = 0; i < participants; ++i) {
+			const uint64_t begin = (uint64_t) count * i / participants;
+			const uint64_t end = (uint64_t) count * (i + 1) / participants;
+			ranges[i].bounds.store(begin << 32 | end, std::memory_order_relaxed);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busy = participants - 1;
+			++generation;
+		}
+		wake.notify_all();
+
+		run(0);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return busy == 0; });
+	}
+
+private:
+	struct alignas(64) Range {
+		std::atomic<uint64_t> bounds { 0 };
+	};
+
+	void workerLoop(unsigned self, uint64_t seen) {
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&] { return stopping || generation != seen; });
+				if (stopping)
+					return;
+				seen = generation;
+			}
+
+			run(self);
+
+			bool last;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				last = --busy == 0;
+			}
+			if (last)
+				done.notify_one();
+		}
+	}
+
+	void run(unsigned self) {
+		uint32_t begin, end;
+		for (;;) {
+			if (takeFront(self, begin, end))
+				task(taskContext, begin, end);
+			else if (!steal(self))
+				return;
+		}
+	}
+
+	// Takes the next chunk of this participant's own range
+	bool takeFront(unsigned self, uint32_t& begin, uint32_t& end) {
+		std::atomic<uint64_t>& bounds = ranges[self].bounds;
+		uint64_t current = bounds.load(std::memory_order_acquire);
+		for (;;) {
+			const uint32_t first = (uint32_t) (current >> 32), last = (uint32_t) current;
+			if (first >= last)
+				return false;
+			const uint32_t next = last - first > taskGrain ? first + taskGrain : last;
+			if (bounds.compare_exchange_weak(current, (uint64_t) next << 32 | last, std::memory_order_acq_rel)) {
+				begin = first;
+				end = next;
+				return true;
+			}
+		}
+	}
+
+	// Moves the back half of the largest other range into this participant's (empty) range
+	bool steal(unsigned self) {
+		for (;;) {
+			unsigned victim = self;
+			uint64_t current = 0;
+			uint32_t largest = 0;
+			for (unsigned i = 0; i < participants; ++i) {
+				const uint64_t bounds = ranges[i].bounds.load(std::memory_order_acquire);
+				const uint32_t first = (uint32_t) (bounds >> 32), last = (uint32_t) bounds;
+				if (i != self && first < last && last - first > largest) {
+					victim = i;
+					current = bounds;
+					largest = last - first;
+				}
+			}
+			if (victim == self)
+				return false;
+
+			const uint32_t first = (uint32_t) (current >> 32), last = (uint32_t) current;
+			const uint32_t middle = first + (last - first) / 2;
+			if (ranges[victim].bounds.compare_exchange_strong(current, (uint64_t) first << 32 | middle, std::memory_order_acq_rel)) {
+				ranges[self].bounds.store((uint64_t) middle << 32 | last, std::memory_order_release);
+				return true;
+			}
+		}
+	}
+
+	std::vector<std::thread> threads;
+	std::unique_ptr<Range[]> ranges;
+	unsigned participants = 1;
+
+	void (*task)(void*, uint32_t, uint32_t) = nullptr;
+	void* taskContext = nullptr;
+	uint32_t taskGrain = 1;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	uint64_t generation = 0; // guarded by mutex
+	unsigned busy = 0;       // workers still in the current loop, guarded by mutex
+	bool stopping = false;
+};
@@ -0,0 +1,214 @@
+// line_table.h
+// Start of every line of a text, as codepoint positions: 0 plus the position after each '\n'.
+//
+// The starts are kept in chunks of about CHUNK lines, each relative to the chunk's first line. The
+// chunk origins (as differences from the chunk before) and line counts are summed in Fenwick trees
+// (fenwick_tree.h), so an edit shifts the starts after it in its own chunk and updates O(log chunks)
+// sums instead of every later line. A chunk splits at twice CHUNK lines, and the chunks an erase
+// spans merge, which rebuilds the sums in O(chunks).
+//
+// Lookups remember the chunk they found, and lineOf the line, so walking line by line (stb's
+// cursor up/down, locating a click, tessellating the lines on screen) costs O(1) per line.
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include "fenwick_tree.h"
+#include "utf8.h"
+
+class LineTable {
+public:
+	static constexpr size_t CHUNK = 512; // lines per chunk when (re)built; split at twice that
+
+	size_t size() const { return lines; }
+
+	// Start of line (< size())
+	int operator[](size_t line) const {
+		const size_t k = chunkOfLine(line);
+		return chunkOrigin + chunks[k][line - chunkLine];
+	}
+
+	// Index of the line containing codepoint pos. The last answer and the line after it are tried
+	// first.
+	int lineOf(int pos) const {
+		const size_t k = chunkOf(pos);
+		const std::vector<int>& starts = chunks[k];
+		const int offset = pos - chunkOrigin;
+		if (cachedLine >= chunkLine && cachedLine < chunkLine + starts.size()) {
+			for (size_t i = cachedLine - chunkLine; i < starts.size() && i <= cachedLine - chunkLine + 1; ++i) {
+				if (starts[i] <= offset && (i + 1 == starts.size() || offset < starts[i + 1]))
+					return (int) (cachedLine = chunkLine + i);
+			}
+		}
+		const auto it = std::upper_bound(starts.begin(), starts.end(), offset);
+		return (int) (cachedLine = chunkLine + (size_t) (it - starts.begin()) - 1);
+	}
+
+	// One line at 0, for rebuilding the table with append()
+	void clear() {
+		chunks.assign(1, std::vector<int>(1, 0));
+		origins = FenwickTree<int>(1);
+		counts = FenwickTree<size_t>(1, 1);
+		lines = 1;
+		forget();
+	}
+
+	// Adds a line starting at start, after the last one
+	void append(int start) {
+		const int lastOrigin = origins.prefix(chunks.size());
+		if (chunks.back().size() >= CHUNK) {
+			chunks.emplace_back(1, 0);
+			origins.push_back(start - lastOrigin);
+			counts.push_back(1);
+		} else {
+			chunks.back().push_back(start - lastOrigin);
+			counts.set(chunks.size() - 1, chunks.back().size());
+		}
+		++lines;
+	}
+
+	// After num codepoints, the size bytes of UTF-8 at text, were inserted at codepoint pos: one new
+	// line per '\n', and the lines after pos move
+	void inserted(int pos, const char* text, size_t size, int num) {
+		const size_t line = (size_t) lineOf(pos);
+		const size_t k = cachedChunk;
+		std::vector<int>& starts = chunks[k];
+		const size_t at = line - chunkLine + 1;
+		for (size_t i = at; i < starts.size(); ++i)
+			starts[i] += num;
+
+		const size_t breaks = (size_t) std::count(text, text + size, '\n');
+		if (breaks > 0) {
+			starts.insert(starts.begin() + at, breaks, 0);
+			size_t i = at;
+			const char* counted = text;
+			int codepoint = pos - chunkOrigin;
+			for (const char* p = text; (p = (const char*) std::memchr(p, '\n', text + size - p)); ++p) {
+				codepoint += (int) utf8_count(counted, p + 1 - counted);
+				counted = p + 1;
+				starts[i++] = codepoint;
+			}
+			counts.set(k, starts.size());
+			lines += breaks;
+		}
+		if (k + 1 < chunks.size())
+			origins.set(k + 1, origins.value(k + 1) + num);
+		if (starts.size() > 2 * CHUNK)
+			split(k);
+		forget();
+	}
+
+	// After num codepoints were erased at codepoint pos: the lines whose '\n' was erased merge into
+	// the line before them, and the lines after the erased codepoints move
+	void erased(int pos, int num) {
+		if (num == 0)
+			return;
+		lineOf(pos);
+		const size_t first = cachedChunk;
+		const int origin = chunkOrigin;
+		const size_t last = origins.find(pos + num) - 1; // chunk holding the end of the erase
+		std::vector<int>& starts = chunks[first];
+		const auto from = std::upper_bound(starts.begin(), starts.end(), pos - origin);
+		const size_t before = starts.size();
+		if (first == last) {
+			for (auto it = starts.erase(from, std::upper_bound(from, starts.end(), pos + num - origin)); it != starts.end(); ++it)
+				*it -= num;
+			if (first + 1 < chunks.size())
+				origins.set(first + 1, origins.value(first + 1) - num);
+			lines -= before - starts.size();
+			counts.set(first, starts.size());
+		} else {
+			// The lines of the last chunk after the erase move into the first one
+			starts.erase(from, starts.end());
+			const int lastChunkOrigin = origins.prefix(last + 1);
+			size_t removed = before - starts.size();
+			for (size_t k = first + 1; k <= last; ++k)
+				removed += chunks[k].size();
+			for (int start : chunks[last]) {
+				if (lastChunkOrigin + start > pos + num) {
+					starts.push_back(lastChunkOrigin + start - num - origin);
+					--removed;
+				}
+			}
+			if (last + 1 < chunks.size())
+				origins.set(last + 1, lastChunkOrigin + origins.value(last + 1) - num - origin);
+			chunks.erase(chunks.begin() + first + 1, chunks.begin() + last + 1);
+			const int* noOrigins = nullptr;
+			origins.replace(first + 1, last + 1, noOrigins, noOrigins);
+			const size_t count = starts.size();
+			counts.replace(first, last + 1, &count, &count + 1);
+			lines -= removed;
+			if (starts.size() > 2 * CHUNK)
+				split(first);
+		}
+		forget();
+	}
+
+private:
+	// Chunk holding line, whose first line and origin it leaves in chunkLine and chunkOrigin
+	size_t chunkOfLine(size_t line) const {
+		if (line >= chunkLine && line - chunkLine < chunks[cachedChunk].size())
+			return cachedChunk;
+		return locate(counts.find(line));
+	}
+
+	// Chunk holding codepoint pos; see chunkOfLine
+	size_t chunkOf(int pos) const {
+		if (pos >= chunkOrigin && (cachedChunk + 1 == chunks.size() || pos < chunkOrigin + origins.value(cachedChunk + 1)))
+			return cachedChunk;
+		return locate(origins.find(pos) - 1); // origins.value(0) is 0, so find() passes it
+	}
+
+	size_t locate(size_t k) const {
+		cachedChunk = k;
+		chunkLine = counts.prefix(k);
+		chunkOrigin = origins.prefix(k + 1);
+		return k;
+	}
+
+	// Cuts chunk k into chunks of CHUNK lines
+	void split(size_t k) {
+		std::vector<int> starts = std::move(chunks[k]);
+		std::vector<std::vector<int>> pieces;
+		std::vector<int> pieceOrigins;
+		std::vector<size_t> pieceCounts;
+		int origin = 0; // of the current piece, relative to the chunk
+		for (size_t first = 0; first < starts.size(); first += CHUNK) {
+			const size_t last = std::min(starts.size(), first + CHUNK);
+			pieceOrigins.push_back(starts[first] - origin);
+			origin = starts[first];
+			pieces.emplace_back();
+			for (size_t i = first; i < last; ++i)
+				pieces.back().push_back(starts[i] - origin);
+			pieceCounts.push_back(last - first);
+		}
+		pieceOrigins[0] = origins.value(k);
+		if (k + 1 < chunks.size())
+			origins.set(k + 1, origins.value(k + 1) - origin);
+
+		chunks.erase(chunks.begin() + k);
+		chunks.insert(chunks.begin() + k, std::make_move_iterator(pieces.begin()), std::make_move_iterator(pieces.end()));
+		origins.replace(k, k + 1, pieceOrigins.begin(), pieceOrigins.end());
+		counts.replace(k, k + 1, pieceCounts.begin(), pieceCounts.end());
+	}
+
+	void forget() {
+		cachedChunk = 0;
+		chunkLine = 0;
+		chunkOrigin = 0;
+		cachedLine = 0;
+	}
+
+	std::vector<std::vector<int>> chunks = { { 0 } }; // starts relative to the chunk's first line
+	FenwickTree<int> origins { 1 };   // chunk origin minus the one before, 0 for the first chunk
+	FenwickTree<size_t> counts { 1, 1 }; // lines per chunk
+	size_t lines = 1;
+	mutable size_t cachedChunk = 0;
+	mutable size_t chunkLine = 0;  // first line of cachedChunk
+	mutable int chunkOrigin = 0;   // start of that line
+	mutable size_t cachedLine = 0; // last lineOf answer
+};
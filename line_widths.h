@@ -0,0 +1,95 @@
+// line_widths.h
+// Pen x offsets of the lines of a text, kept only for the lines that have been looked at.
+//
+// text_control lays a line out the first time its offsets are needed (drawing it, moving the caret
+// over it, hit testing) rather than when the document is opened, so opening a large file shapes
+// nothing and costs one slot per line instead of a float per character. Each line's offsets live in
+// an array of their own, which stays put while other lines are shaped. An edit forgets the offsets
+// of the lines it touched, the next look shapes them again; trim() drops the lines out of sight once
+// more than MAX_SHAPED hold offsets.
+
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "text_storage.h"
+
+class LineWidths {
+public:
+	static constexpr size_t MAX_SHAPED = 16384; // shaped lines trim() lets through
+
+	size_t size() const { return slots.size(); }
+	size_t shapedCount() const { return entries.size() - unused.size(); }
+
+	// lines lines, none of them shaped
+	void reset(size_t lines) {
+		slots.assign(lines, NONE);
+		entries.clear();
+		unused.clear();
+	}
+
+	// Offsets of line, or nullptr when it has not been shaped since it was last edited
+	const float* find(size_t line) const {
+		const uint32_t slot = slots[line];
+		return slot == NONE ? nullptr : entries[slot].data();
+	}
+
+	// Room for the count offsets of line, which has none. Stays valid until the line is edited or
+	// trimmed away.
+	float* shape(size_t line, size_t count) {
+		uint32_t slot;
+		if (!unused.empty()) {
+			slot = unused.back();
+			unused.pop_back();
+		} else {
+			slot = (uint32_t) entries.size();
+			entries.emplace_back();
+		}
+		entries[slot].assign(count, 0.0f);
+		slots[line] = slot;
+		return entries[slot].data();
+	}
+
+	// After an edit replaced lines [line, line + count) by replacement lines, none of them shaped
+	void replace(size_t line, size_t count, size_t replacement) {
+		for (size_t i = line; i < line + count; ++i)
+			release(i, false);
+		if (replacement > count)
+			slots.insert(line + count, replacement - count, NONE);
+		else if (replacement < count)
+			slots.erase(line + replacement, count - replacement);
+	}
+
+	// When more than MAX_SHAPED lines hold offsets, frees those of the lines outside [first, last].
+	// O(lines), which the MAX_SHAPED shapes in between pay for. Call it between frames, not while
+	// offsets are in use.
+	void trim(size_t first, size_t last) {
+		if (shapedCount() <= MAX_SHAPED)
+			return;
+		for (size_t line = 0; line < slots.size(); ++line) {
+			if (line < first || line > last)
+				release(line, true);
+		}
+	}
+
+private:
+	static constexpr uint32_t NONE = UINT32_MAX;
+
+	// Forgets the offsets of line. An edited line is shaped again right away, so its array keeps
+	// its capacity for that; a trimmed one gives its memory back.
+	void release(size_t line, bool free) {
+		const uint32_t slot = slots[line];
+		if (slot == NONE)
+			return;
+		if (free)
+			std::vector<float>().swap(entries[slot]);
+		unused.push_back(slot);
+		slots[line] = NONE;
+	}
+
+	GapBuffer<uint32_t> slots;              // index into entries per line, NONE while unshaped
+	std::vector<std::vector<float>> entries; // offsets of the shaped lines
+	std::vector<uint32_t> unused;           // entries no line uses
+};
@@ -20,9 +20,17 @@
 #include <array>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <algorithm>
 #include <chrono>
 #include <memory> // For std::unique_ptr
+#include <future>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <cstdio>
+#include <cstring>
+#include <climits>
 
 // SDL for windowing and input
 #include <SDL3/SDL.h>
@@ -32,57 +40,204 @@
 #include <bgfx/bgfx.h>
 #include <bgfx/platform.h>
 #include <bx/math.h>
+#include <bgfx/embedded_shader.h>
+
+// Instruction set of the glyph quad kernel (writeGlyphCorners); scalar when neither is available
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GLYPH_KERNEL_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define GLYPH_KERNEL_NEON
+#include <arm_neon.h>
+#endif
+
+#include "text_storage.h"
+#include "utf8.h"
+#include "line_table.h"
+#include "line_widths.h"
+#include "glyph_atlas.h"
+#include "text_file.h"
+#include "text_undo.h"
+#include "profiler.h"
+#include "job_pool.h"
+#include "shaped_run_cache.h"
+#include "text_search.h"
+#include "frame_arena.h"
+#include "spsc_queue.h"
+#include "shaders.bin.h" // generated, see CMakeLists.txt
+#if defined(EDITING_EMBEDDED_FONT)
+#include "embedded_font.bin.h"
+#endif
+#if defined(EDITING_COUNT_ALLOCATIONS) || defined(EDITING_TEXT_BENCH)
+#include "heap_counter.h"
+#endif
 
+// Initial window size; the backbuffer follows the window (see TextEditorApp::applyResize)
 const int SCREEN_WIDTH = 800;
 const int SCREEN_HEIGHT = 600;
 
-using AtlasGeneratorType = msdf_atlas::ImmediateAtlasGenerator<
-	float, // pixel type of buffer for individual glyphs depends on generator function
-	3, // number of atlas color channels
-	msdf_atlas::msdfGenerator, // function to generate bitmaps for individual glyphs
-	msdf_atlas::BitmapAtlasStorage<msdf_atlas::byte, 3> // class that stores the atlas bitmap
-	// For example, a custom atlas storage class that stores it in VRAM can be used.
->;
+// Pixels per em of the layout: the line widths, the line table and the glyph meshes are all at this size.
+// Drawing at another size scales the mesh with its transform (see TextEditorApp::zoom).
+constexpr double FONT_SIZE = 24.0;
 
-// --- Graphics Context and STB Callbacks ---
-struct AppContext {
-	msdfgen::FreetypeHandle *ft = nullptr;
+// Pen-relative corners of one glyph quad (bottom left, bottom right, top right, top left), atlas UVs
+// quantized and packed the way GlyphVertex stores them. All zero for characters that draw nothing.
+struct alignas(16) GlyphCorners {
+	float x[4];
+	float y[4];
+	uint32_t uv[4]; // int16 u | int16 v << 16
+};
 
-	bgfx::TextureHandle fontAtlas = BGFX_INVALID_HANDLE;
+// Codepoints below this are their own glyph id; see GlyphTables
+constexpr uint32_t LATIN1_GLYPHS = 256;
+
+// Dense per-font metric tables, built once in acquireFont so that the stb callbacks and the
+// renderer never have to go through FontGeometry's glyph/kerning maps per character.
+// Indexed by glyph id: the codepoint itself for Latin-1, which is loaded up front with its kerning,
+// and ids from LATIN1_GLYPHS up for the other codepoints, handed out by glyph_id() on first use
+// and never kerned. Characters the font lacks resolve to '?'.
+struct GlyphTables {
+	double fsScale = 0.0;    // font units -> pixels at FONT_SIZE
+	double lineHeight = 0.0; // pixels
+	std::vector<float> advance = std::vector<float>(LATIN1_GLYPHS);            // pixels
+	std::vector<AtlasGlyph*> glyph = std::vector<AtlasGlyph*>(LATIN1_GLYPHS);  // nullptr when nothing is drawn
+	std::vector<float> kerning = std::vector<float>(256 * 256); // pixels, [first << 8 | second], Latin-1 only
+	// Ready glyphs as quad corners for writeGlyphQuadRun, refreshed by update_glyph_corners()
+	std::vector<GlyphCorners> corners = std::vector<GlyphCorners>(LATIN1_GLYPHS);
+	std::vector<uint8_t> pending = std::vector<uint8_t>(LATIN1_GLYPHS); // has a glyph that still has to be requested
+	std::unordered_map<char32_t, uint32_t> extended; // glyph ids of the codepoints past Latin-1
+
+	float pairAdvance(uint32_t first, uint32_t second) const {
+		return advance[first] + ((first | second) < LATIN1_GLYPHS ? kerning[(first << 8) | second] : 0.0f);
+	}
+};
+
+// One loaded font and everything derived from it: metric tables, glyph atlas, atlas cache and
+// shaped-run cache. Shared by reference count between every text_control that uses the font (see
+// acquireFont), so a screen of text fields costs one atlas and one set of tables. The last owner
+// to let go saves the atlas cache and frees the atlas texture, which has to happen while bgfx is up.
+struct FontFace {
+	std::string path;                    // as passed to acquireFont
+	msdfgen::FontHandle *font = nullptr; // kept open, the atlas loads glyph outlines on demand
+	void *fontData = nullptr;            // file bytes backing `font`, freed with the face; null for the embedded font
+	double geometryScale = 1.0;          // font units -> geometry units of the atlas glyphs
+	uint64_t cacheKey = 0;
+	std::string cachePath;               // empty for faces that are not backed by a cache
+
+	GlyphAtlas atlas;
+	ShapedRunCache runs; // measured lines, see shape_run
 	std::vector<msdf_atlas::GlyphGeometry> glyphs;
 	std::unique_ptr<msdf_atlas::FontGeometry> fontGeometry = nullptr;
-	msdf_atlas::TightAtlasPacker packer;
+	GlyphTables tables;
+
+	FontFace() = default;
+	FontFace(const FontFace&) = delete;
+	FontFace& operator=(const FontFace&) = delete;
+	~FontFace();
+};
+
+// --- Graphics Context and STB Callbacks ---
+struct AppContext {
+	msdfgen::FreetypeHandle *ft = nullptr;
+	Profiler profiler; // scoped timers on the hot paths, see the F3 overlay
+	JobPool jobs;      // tessellation workers, see tessellate_glyph_spans
+	FrameArena frame;  // scratch memory of the frame being built, see submit_frame
+	std::vector<std::weak_ptr<FontFace>> faces; // loaded fonts, see acquireFont
+	std::function<void()> glyphsReady;          // GlyphAtlas::setNotify of every face
+	int viewWidth = SCREEN_WIDTH;   // backbuffer size in pixels, see text_viewport
+	int viewHeight = SCREEN_HEIGHT;
 };
 static AppContext g_AppContext;
 
+// Atlas glyph to draw for a glyph id, or nullptr if it has no ink or is not in the atlas yet.
+// The first miss queues the glyph for generation; it shows up once GlyphAtlas::pump uploads it.
+AtlasGlyph* drawable_glyph(FontFace& face, uint32_t id) {
+	AtlasGlyph* glyph = face.tables.glyph[id];
+	if (!glyph || glyph->state == AtlasGlyph::State::Ready)
+		return glyph;
+	face.atlas.request(*glyph);
+	return nullptr;
+}
+
+void update_glyph_corners(FontFace& face, uint32_t first = 0);
+
+// Glyph id of a codepoint, see GlyphTables. A codepoint past Latin-1 gets the next free id the
+// first time it is seen, with the advance of its outline; the atlas generates it on demand like
+// any other glyph. Main thread only.
+uint32_t glyph_id(FontFace& face, char32_t codepoint) {
+	if (codepoint < LATIN1_GLYPHS)
+		return codepoint;
+	GlyphTables& tables = face.tables;
+	if (const auto it = tables.extended.find(codepoint); it != tables.extended.end())
+		return it->second;
+
+	uint32_t id = '?';
+	msdfgen::GlyphIndex index;
+	msdf_atlas::GlyphGeometry geometry;
+	if (face.font && msdfgen::getGlyphIndex(index, face.font, codepoint) && geometry.load(face.font, face.geometryScale, index)) {
+		id = (uint32_t) tables.advance.size();
+		tables.advance.push_back((float) (tables.fsScale * geometry.getAdvance()));
+		tables.glyph.push_back(geometry.isWhitespace() ? nullptr : face.atlas.find((msdf_atlas::unicode_t) codepoint));
+		tables.corners.emplace_back();
+		tables.pending.push_back(0);
+		update_glyph_corners(face, id);
+	}
+	tables.extended.emplace(codepoint, id);
+	return id;
+}
+
 // STB Text Edit Library Configuration
 // -----------------------------------
 // Define all the #defines needed for stb_textedit
 
-#define STB_TEXTEDIT_CHARTYPE           char
+#define STB_TEXTEDIT_CHARTYPE           char32_t
 #define STB_TEXTEDIT_STRING             text_control
+#if !defined(TEXT_STORAGE_GAP_BUFFER)
+// The piece table keeps its history in text_control::undo; stb's records are never replayed, so
+// its buffers are shrunk to the minimum and deletes stop copying characters into them.
+#define STB_TEXTEDIT_UNDOSTATECOUNT     1
+#define STB_TEXTEDIT_UNDOCHARCOUNT      1
+#endif
 
 #include "stb_textedit.h"
 
+// The text is stored as UTF-8 and always valid (see valid_utf8), while stb_textedit, the line
+// table, the line widths and the mesh slots count codepoints; `index` maps one to the other.
 struct text_control
 {
-	std::string string;
+	std::shared_ptr<FontFace> face; // needed before any text is put in
+	text_storage string;
+	CodepointIndex index; // codepoint position -> byte offset in string
 	STB_TexteditState state;
+	// Pen x offset before each character relative to the start of its line, shaped per line on
+	// first use (see line_prefix_x) and forgotten for the lines an edit touches, so caret, selection
+	// and hit testing are lookups.
+	LineWidths widths;
+	// Index of the first character of every line, i.e. 0 plus the position after each '\n'.
+	LineTable line_starts;
+	// First character whose glyph quad in the retained text mesh is stale (SIZE_MAX when clean)
+	size_t mesh_dirty_from = 0;
+#if !defined(TEXT_STORAGE_GAP_BUFFER)
+	TextUndo undo; // recorded by insert_chars/delete_chars/text_paste, see text_undo()
+#endif
+	TextSearch search; // query and matches of text_find(), kept up to date by every edit
 };
 
-void getTextSize(text_control *str, std::string_view text, int* w, int* h);
 int delete_chars(text_control *str, int pos, int num);
-int insert_chars(text_control *str, int pos, char *newtext, int num);
+int insert_chars(text_control *str, int pos, char32_t *newtext, int num);
+char32_t text_char(text_control *str, int pos);
+bool text_is_space(char32_t character);
 float get_width_func(text_control* str, int n, int i);
 void layout_func(StbTexteditRow *row, text_control *str, int start_i);
 
-#define STB_TEXTEDIT_STRINGLEN(tc)      ((tc)->string.length())
+#define STB_TEXTEDIT_STRINGLEN(tc)      ((int) (tc)->index.size())
 #define STB_TEXTEDIT_LAYOUTROW          layout_func
 #define STB_TEXTEDIT_GETWIDTH           get_width_func
+#define STB_TEXTEDIT_GETWIDTH_NEWLINE   -1.0f
 #define STB_TEXTEDIT_KEYTOTEXT(key)     (((key) & 0xff000000) ? 0 : (key))
-#define STB_TEXTEDIT_GETCHAR(tc,i)      ((tc)->string[i])
+#define STB_TEXTEDIT_GETCHAR(tc,i)      text_char(tc, i)
 #define STB_TEXTEDIT_NEWLINE            '\n'
-#define STB_TEXTEDIT_IS_SPACE(ch)       isspace(ch)
+#define STB_TEXTEDIT_IS_SPACE(ch)       text_is_space(ch)
 #define STB_TEXTEDIT_DELETECHARS        delete_chars
 #define STB_TEXTEDIT_INSERTCHARS        insert_chars
 
@@ -113,345 +268,1282 @@ void layout_func(StbTexteditRow *row, text_control *str, int start_i);
 #include "stb_textedit.h"
 
 
+// Index of the line containing pos. The line table remembers the last answer, so stb's row-by-row
+// walks (cursor up/down, locating a click) cost O(1) per row instead of a search.
+int line_of(text_control *str, int pos) {
+	return str->line_starts.lineOf(pos);
+}
+
+// Position of the '\n' ending a line, or the end of the text for the last line.
+int line_end(const text_control *str, int line) {
+	return line + 1 < (int) str->line_starts.size() ? str->line_starts[line + 1] - 1 : (int) str->index.size();
+}
+
+// Calls fn(char32_t) for the count codepoints from codepoint pos. Storage spans start and end on
+// codepoints, since the text is valid UTF-8 and every edit inserts or removes whole codepoints.
+template <typename Fn>
+void for_each_codepoint(text_control *str, size_t pos, size_t count, Fn&& fn) {
+	const size_t first = str->index.byteOf(str->string, pos);
+	const size_t last = str->index.byteOf(str->string, pos + count);
+	str->string.forEachSpan(first, last - first, [&](const char* span, size_t length) {
+		for (const char* p = span; p < span + length; )
+			fn(utf8_decode(p));
+	});
+}
+
+// Codepoint at pos, for STB_TEXTEDIT_GETCHAR. Consecutive positions are O(1), see CodepointIndex.
+char32_t text_char(text_control *str, int pos) {
+	if (pos < 0 || (size_t) pos >= str->index.size())
+		return 0;
+	const size_t byte = str->index.byteOf(str->string, pos);
+	char bytes[4] = { str->string[byte] };
+	const size_t length = utf8_sequence_length(bytes[0]);
+	for (size_t k = 1; k < length; ++k)
+		bytes[k] = str->string[byte + k];
+	const char* p = bytes;
+	return utf8_decode(p);
+}
+
+// Word boundaries for stb_textedit: the ASCII white space, no-break and the Unicode spaces
+bool text_is_space(char32_t character) {
+	return character == ' ' || (character >= '\t' && character <= '\r') || character == 0xa0
+		|| (character >= 0x2000 && character <= 0x200a) || character == 0x3000;
+}
+
+// Pen x after each of the count glyphs of one line, relative to its start; broken when a '\n'
+// follows, which takes part in the last kerning pair. glyphs are glyph ids, or ASCII bytes, which
+// are their own. Writes the offsets to penX when given and returns the line width.
+template <typename Glyph>
+float measure_run(const GlyphTables& tables, const Glyph* glyphs, size_t count, bool broken, float* penX = nullptr) {
+	float x = 0.0f;
+	for (size_t i = 0; i < count; ++i) {
+		const uint32_t glyph = glyphs[i];
+		if (i + 1 < count)
+			x += tables.pairAdvance(glyph, glyphs[i + 1]);
+		else
+			x += broken ? tables.pairAdvance(glyph, '\n') : tables.advance[glyph];
+		if (penX)
+			penX[i] = x;
+	}
+	return x;
+}
+
+// Glyph ids of the codepoints in size bytes of UTF-8, written to glyphs; returns their number
+size_t utf8_glyphs(FontFace& face, const char* text, size_t size, uint32_t* glyphs) {
+	const size_t count = utf8_decode(text, size, glyphs);
+	for (size_t i = 0; i < count; ++i)
+		glyphs[i] = glyph_id(face, glyphs[i]);
+	return count;
+}
+
+// measure_run of the count codepoints in size bytes through the shaped-run cache: a repeated line
+// costs one hash and one lookup. Returns nullptr for lines longer than
+// ShapedRunCache::MAX_RUN_LENGTH bytes, which are not cached; otherwise the offsets stay valid
+// until the next call.
+const float* shape_run(FontFace& face, const char* text, size_t size, size_t count, bool broken) {
+	if (count == 0 || size > ShapedRunCache::MAX_RUN_LENGTH)
+		return nullptr;
+
+	uint64_t seed;
+	std::memcpy(&seed, &face.tables.fsScale, sizeof(seed));
+	const uint64_t key = ShapedRunCache::hash(text, size, seed ^ (broken ? 1 : 0));
+	ShapedRunCache& cache = face.runs;
+	bool admit;
+	if (const float* penX = cache.find(key, count, admit))
+		return penX;
+	// main thread only, like the cache
+	static float scratch[ShapedRunCache::MAX_RUN_LENGTH];
+	static uint32_t glyphs[ShapedRunCache::MAX_RUN_LENGTH];
+	float* penX = admit ? cache.insert(key, count) : scratch;
+	if (size == count) {
+		measure_run(face.tables, reinterpret_cast<const unsigned char*>(text), count, broken, penX);
+	} else {
+		utf8_glyphs(face, text, size, glyphs);
+		measure_run(face.tables, glyphs, count, broken, penX);
+	}
+	return penX;
+}
+
+// Writes the offsets of the line [start, end] to x: the pen x before each of its characters, its
+// '\n' (or the end of the text) included, from the shaped-run cache when it can. Each character
+// pairs with the one after it, the line's '\n' included.
+void shape_line_x(text_control *str, size_t start, size_t end, float* x) {
+	FontFace& face = *str->face;
+	const size_t length = str->index.size();
+	const size_t count = end - start;
+	const size_t first = str->index.byteOf(str->string, start);
+	const size_t size = str->index.byteOf(str->string, end) - first;
+	x[0] = 0.0f;
+	if (count > 0 && size <= ShapedRunCache::MAX_RUN_LENGTH) {
+		char text[ShapedRunCache::MAX_RUN_LENGTH];
+		str->string.copyTo(first, size, text);
+		const float* penX = shape_run(face, text, size, count, end < length);
+		std::copy(penX, penX + count, x + 1);
+		return;
+	}
+
+	const GlyphTables& tables = face.tables;
+	float pen = 0.0f;
+	size_t i = 0;
+	uint32_t glyph = 0;
+	for_each_codepoint(str, start, std::min(end + 1, length) - start, [&](char32_t character) {
+		const uint32_t next = glyph_id(face, character);
+		if (i > 0)
+			x[i] = pen += tables.pairAdvance(glyph, next);
+		glyph = next;
+		++i;
+	});
+	if (end >= length && count > 0)
+		x[count] = pen + tables.advance[glyph];
+}
+
+// Offsets of line: the pen x before each of its characters relative to its start, for the
+// positions line_starts[line] through line_end(line). The line is shaped on first use; the pointer
+// stays valid until the next edit or LineWidths::trim.
+const float* line_prefix_x(text_control *str, int line) {
+	if (const float* x = str->widths.find(line))
+		return x;
+	const size_t start = str->line_starts[line];
+	const size_t end = line_end(str, line);
+	float* x = str->widths.shape(line, end - start + 1);
+	shape_line_x(str, start, end, x);
+	return x;
+}
+
+// Pen x before character i (i <= index.size()) relative to the start of its line
+float prefix_x(text_control *str, int i) {
+	const int line = line_of(str, i);
+	return line_prefix_x(str, line)[i - str->line_starts[line]];
+}
+
+// Rebuilds the codepoint and per-line indices from scratch, e.g. after the font changed. Reads the
+// whole text once, but shapes nothing: the lines are laid out when they are first looked at.
+void rebuild_text_index(text_control *str) {
+	str->index.build(str->string);
+
+	// memchr over the storage spans, so a freshly opened (mapped) document is scanned sequentially;
+	// the codepoints between two line breaks are counted 16 bytes at a time
+	str->line_starts.clear();
+	size_t codepoint = 0;
+	str->string.forEachSpan(0, str->string.size(), [&](const char* span, size_t spanLength) {
+		const char* counted = span;
+		for (const char* p = span; (p = (const char*) std::memchr(p, '\n', span + spanLength - p)); ++p) {
+			codepoint += utf8_count(counted, p + 1 - counted);
+			counted = p + 1;
+			str->line_starts.append((int) codepoint);
+		}
+		codepoint += utf8_count(counted, span + spanLength - counted);
+	});
+
+	str->widths.reset(str->line_starts.size());
+	str->mesh_dirty_from = 0;
+	str->search.restart();
+}
+
+// Deletes without recording an undo step
+void remove_chars(text_control *str, int pos, int num) {
+	const size_t first = str->index.byteOf(str->string, pos);
+	const size_t size = str->index.byteOf(str->string, pos + num) - first;
+	str->string.erase(first, size);
+	str->index.erased(pos, num, size);
+	str->search.edited(str->string, first, size, 0);
+
+	// Lines whose preceding '\n' was deleted merge into the line before them, which has to be
+	// shaped again
+	const int first_line = line_of(str, pos);
+	const int last_line = line_of(str, pos + num);
+	str->line_starts.erased(pos, num);
+	str->widths.replace(first_line, last_line - first_line + 1, 1);
+
+	str->mesh_dirty_from = std::min(str->mesh_dirty_from, (size_t) pos);
+}
+
 int delete_chars(text_control *str, int pos, int num) {
-	str->string.erase(pos, num);
+#if !defined(TEXT_STORAGE_GAP_BUFFER)
+	const size_t first = str->index.byteOf(str->string, pos);
+	str->undo.recordDelete(str->string, first, str->index.byteOf(str->string, pos + num) - first);
+#endif
+	remove_chars(str, pos, num);
+	return 1;
+}
+
+// Line part of an insert of num codepoints, size bytes of UTF-8, at pos: the line table, and the
+// edited line and those the new line breaks split off it have to be shaped again. Independent of
+// the storage, so it can run before text handed to the storage with adopt() is released.
+void insert_line_starts(text_control *str, int pos, const char *newtext, size_t size, int num) {
+	const int line = line_of(str, pos);
+	const size_t lines = str->line_starts.size();
+	str->line_starts.inserted(pos, newtext, size, num);
+	str->widths.replace(line, 1, 1 + str->line_starts.size() - lines);
+	str->mesh_dirty_from = std::min(str->mesh_dirty_from, (size_t) pos);
+}
+
+// Inserts num codepoints, size bytes of valid UTF-8, at codepoint pos. put(byte) puts the bytes
+// into the storage at byte offset byte; the indices are updated around it.
+template <typename Put>
+void insert_utf8(text_control *str, int pos, const char *text, size_t size, int num, Put&& put) {
+	const size_t byte = str->index.byteOf(str->string, pos);
+	insert_line_starts(str, pos, text, size, num);
+	put(byte);
+	str->index.inserted(str->string, pos, num, size);
+	str->search.edited(str->string, byte, 0, size);
+#if !defined(TEXT_STORAGE_GAP_BUFFER)
+	str->undo.recordInsert(str->string, byte, size);
+#endif
+}
+
+// stb_textedit's insert of codepoints (typing, its own undo records): encoded to UTF-8 in the
+// frame arena, 8 ASCII characters at a time, and copied into the storage.
+int insert_chars(text_control *str, int pos, char32_t *newtext, int num) {
+	char* text = g_AppContext.frame.allocate<char>(4 * (size_t) num);
+	const size_t size = utf8_encode(newtext, num, text);
+	insert_utf8(str, pos, text, size, num, [&](size_t byte) { str->string.insert(byte, text, size); });
+	g_AppContext.frame.deallocate(text, 4 * (size_t) num);
 	return 1;
 }
 
-int insert_chars(text_control *str, int pos, char *newtext, int num) {
-	str->string.insert(pos, newtext, num);
+// Replaces the selection with num codepoints of UTF-8 handed over by put(byte), as
+// stb_textedit_paste does, with the same undo step.
+template <typename Put>
+int text_replace_selection(text_control *str, const char *text, size_t size, Put&& put) {
+	stb_textedit_clamp(str, &str->state);
+	stb_textedit_delete_selection(str, &str->state);
+	if (size == 0)
+		return 0;
+
+	const int pos = str->state.cursor;
+	const int num = (int) utf8_count(text, size);
+	insert_utf8(str, pos, text, size, num, std::forward<Put>(put));
+#if defined(TEXT_STORAGE_GAP_BUFFER)
+	stb_text_makeundo_insert(&str->state, pos, num);
+#endif
+	str->state.cursor += num;
+	str->state.has_preferred_x = 0;
 	return 1;
 }
 
+// stb_textedit_paste for a buffer the caller gives up: hands the text to the storage with
+// adopt(), so the piece table inserts it without copying. size bytes of valid UTF-8.
+int text_paste(text_control *str, OwnedText text, size_t size) {
+	const char* data = text.get();
+	return text_replace_selection(str, data, size, [&](size_t byte) { str->string.adopt(byte, std::move(text), size); });
+}
+
+// stb_textedit_paste of size bytes of valid UTF-8, copied into the storage
+int text_insert(text_control *str, const char *text, size_t size) {
+	return text_replace_selection(str, text, size, [&](size_t byte) { str->string.insert(byte, text, size); });
+}
+
+// Text from outside (files, the clipboard, text input) is taken as it is when it is valid UTF-8 and
+// read as Latin-1 otherwise, so the storage only ever holds valid UTF-8. Returns nullptr when text
+// can be used as it is, else the converted copy, whose length replaces size.
+OwnedText valid_utf8(const char *text, size_t& size) {
+	if (utf8_valid(text, size))
+		return OwnedText(nullptr, SDL_free);
+	char* converted = (char*) SDL_malloc(2 * size + 1);
+	size = utf8_from_latin1(text, size, converted);
+	converted[size] = '\0';
+	return OwnedText(converted, SDL_free);
+}
+
+// Inserts the typed text waiting in pending as one edit. Returns whether there was any.
+bool text_flush_typed(text_control *str, std::string& pending) {
+	if (pending.empty() || !str->face)
+		return false;
+	ProfileScope scope(g_AppContext.profiler, "flushText");
+	size_t size = pending.size();
+	const OwnedText converted = valid_utf8(pending.data(), size);
+	text_insert(str, converted ? converted.get() : pending.data(), size);
+	pending.clear();
+	return true;
+}
+
+// Typed text waits in pending while the event queue drains and goes in with text_flush_typed(), so
+// a burst of characters costs one insert_chars/line table update. Overwrite mode replaces
+// one character per key, which one insert cannot express: such a key flushes the batch first, so
+// the text comes out in the order it was typed. Returns whether the text was applied right away.
+bool text_type(text_control *str, std::string& pending, const char *text, size_t size) {
+	if (!str->face || !str->state.insert_mode || utf8_count(text, size) != 1 || !utf8_valid(text, size)) {
+		pending.append(text, size);
+		return false;
+	}
+	text_flush_typed(str, pending);
+	ProfileScope scope(g_AppContext.profiler, "stb_textedit_key");
+	stb_textedit_key(str, &str->state, (int) utf8_decode(text));
+	return true;
+}
+
+// Ctrl+Z / Ctrl+Y. With the piece table the steps put recorded pieces back instead of copied
+// characters, so undoing a large cut costs O(pieces) plus the index updates; the gap buffer
+// backend uses stb_textedit's history. TextUndo records byte offsets, which the codepoint index
+// turns into positions.
+int text_undo(text_control *str, bool redo) {
+#if !defined(TEXT_STORAGE_GAP_BUFFER)
+	auto replace = [str](size_t byte, size_t size, auto first, auto last) {
+		const int pos = (int) str->index.codepointOf(str->string, byte);
+		if (size > 0)
+			remove_chars(str, pos, (int) str->index.codepointOf(str->string, byte + size) - pos);
+		const size_t before = str->string.size();
+		str->string.insertPieces(byte, first, last);
+		const size_t inserted = str->string.size() - before;
+
+		// Chunk by chunk is the same as one insert of the whole text
+		int offset = pos;
+		str->string.forEachSpan(byte, inserted, [&](const char* span, size_t length) {
+			const int num = (int) utf8_count(span, length);
+			insert_line_starts(str, offset, span, length, num);
+			offset += num;
+		});
+		if (inserted > 0) {
+			str->index.inserted(str->string, pos, offset - pos, inserted);
+			str->search.edited(str->string, byte, 0, inserted);
+		}
+	};
+
+	TextUndo::Change change;
+	if (!(redo ? str->undo.redo(replace, &change) : str->undo.undo(replace, &change)))
+		return 0;
+	str->state.cursor = (int) str->index.codepointOf(str->string, change.pos + change.length);
+	str->state.select_start = str->state.select_end = str->state.cursor;
+	str->state.has_preferred_x = 0;
+	return 1;
+#else
+	stb_textedit_key(str, &str->state, redo ? STB_TEXTEDIT_K_REDO : STB_TEXTEDIT_K_UNDO);
+	return 1;
+#endif
+}
+
+// Ends the undo step being extended by typing or deleting, e.g. when the caret moves.
+void text_seal_undo(text_control *str) {
+#if !defined(TEXT_STORAGE_GAP_BUFFER)
+	str->undo.seal();
+#else
+	(void) str;
+#endif
+}
+
+// Find all: starts a search for size bytes of UTF-8, matched exactly; an empty query ends it. The
+// matches come in through text_search_step, so this returns at once however large the text.
+void text_find(text_control *str, const char *query, size_t size) {
+	str->search.setQuery(query, size);
+}
+
+// Scans the next TextSearch::SLICE bytes for matches; true once they are all known
+bool text_search_step(text_control *str) {
+	return str->search.step(str->string, TextSearch::SLICE);
+}
+
+// Find next (previous when backwards): selects the first match after the cursor, or the last one
+// before the selection, wrapping around the end of the text. Scans ahead as far as it takes.
+bool text_find_next(text_control *str, bool backwards) {
+	TextSearch& search = str->search;
+	if (!search.active())
+		return false;
+	const STB_TexteditState& state = str->state;
+	const int pos = backwards && state.select_start != state.select_end ? std::min(state.select_start, state.select_end) : state.cursor;
+	const size_t byte = str->index.byteOf(str->string, pos);
+	size_t match = 0;
+	if (!(backwards ? search.previous(str->string, byte, match) : search.next(str->string, byte, match)))
+		return false;
+	str->state.select_start = (int) str->index.codepointOf(str->string, match);
+	str->state.select_end = str->state.cursor = (int) str->index.codepointOf(str->string, match + search.getQuery().size());
+	str->state.has_preferred_x = 0;
+	return true;
+}
+
+// A difference of the line's offsets, which hold the kerned advances already, so no character is
+// decoded once the line is shaped; the line breaks are the characters before a line start.
 float get_width_func(text_control* str, int n, int i) {
-	if (!g_AppContext.ft) return 0;
-	char single_char_str[2] = { str->string[i], 0 };
-	int width = 0;
-	getTextSize(str, std::string_view(single_char_str, 1), &width, nullptr);
-	return (float)width;
+	// stb passes the row start in n and the offset within the row in i
+	const int index = n + i;
+	if (!str->face || index < 0 || (size_t) index >= str->index.size()) return 0;
+	const int line = line_of(str, index);
+	if (index == line_end(str, line))
+		return STB_TEXTEDIT_GETWIDTH_NEWLINE;
+	const float* x = line_prefix_x(str, line);
+	const int offset = index - str->line_starts[line];
+	return x[offset + 1] - x[offset];
+}
+
+void buildGlyphTables(FontFace& face) {
+	const msdf_atlas::FontGeometry* fontGeometry = face.fontGeometry.get();
+	const msdfgen::FontMetrics& metrics = fontGeometry->getMetrics();
+	GlyphTables& tables = face.tables;
+
+	tables.fsScale = FONT_SIZE / (metrics.ascenderY - metrics.descenderY);
+	tables.lineHeight = tables.fsScale * metrics.lineHeight;
+
+	const msdf_atlas::GlyphGeometry* fallback = fontGeometry->getGlyph('?');
+	std::vector<std::vector<unsigned char>> charsOfGlyph;
+
+	for (int c = 0; c < 256; ++c) {
+		const msdf_atlas::GlyphGeometry* glyph = fontGeometry->getGlyph(static_cast<msdf_atlas::unicode_t>(c));
+		if (glyph) {
+			if (static_cast<size_t>(glyph->getIndex()) >= charsOfGlyph.size())
+				charsOfGlyph.resize(glyph->getIndex() + 1);
+			charsOfGlyph[glyph->getIndex()].push_back(static_cast<unsigned char>(c));
+		} else {
+			glyph = fallback;
+		}
+
+		tables.advance[c] = glyph ? static_cast<float>(tables.fsScale * glyph->getAdvance()) : 0.0f;
+		tables.glyph[c] = glyph && !glyph->isWhitespace() ? face.atlas.find(glyph->getCodepoint()) : nullptr;
+	}
+
+	// Layout control characters: line breaks take no horizontal space, tabs are four spaces.
+	tables.advance['\n'] = tables.advance['\r'] = 0.0f;
+	tables.glyph['\n'] = tables.glyph['\r'] = tables.glyph['\t'] = nullptr;
+	tables.advance['\t'] = 4.0f * tables.advance[' '];
+
+	std::fill(tables.kerning.begin(), tables.kerning.end(), 0.0f);
+	for (const auto& [pair, value] : fontGeometry->getKerning()) {
+		if (pair.first >= (int) charsOfGlyph.size() || pair.second >= (int) charsOfGlyph.size())
+			continue;
+		for (unsigned char first : charsOfGlyph[pair.first])
+			for (unsigned char second : charsOfGlyph[pair.second])
+				tables.kerning[(first << 8) | second] = static_cast<float>(tables.fsScale * value);
+	}
+}
+
+// Atlas generation settings. They are part of the atlas cache key, so changing any of them
+// (or the font file) makes the next start rebuild the cache.
+constexpr double ATLAS_SCALE = 24.0;    // atlas pixels per geometry unit
+constexpr double ATLAS_PX_RANGE = 2.0;  // distance field range in pixels
+constexpr msdf_atlas::unicode_t TABLE_FIRST_CODEPOINT = 32, TABLE_END_CODEPOINT = 256;
+constexpr uint32_t ATLAS_CACHE_VERSION = 2; // 2: the solid block (GlyphAtlas::SOLID)
+
+// --- Atlas cache ---
+// The metric tables and the atlas contents (see GlyphAtlas::write) are saved at exit and read back
+// on the next start, so a warm start loads no outlines and generates no distance fields; the font
+// is only opened for glyphs the cache does not have yet. Only the Latin-1 part of the tables is
+// saved; glyph_id() hands out the other ids again, finding their atlas glyphs ready.
+struct AtlasCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint64_t key;
+};
+
+// FNV-1a over the font bytes and everything that changes what gets generated
+uint64_t atlas_cache_key(const void* fontData, size_t fontSize) {
+	uint64_t hash = 14695981039346656037ull;
+	auto mix = [&](const void* data, size_t size) {
+		for (size_t i = 0; i < size; ++i)
+			hash = (hash ^ static_cast<const uint8_t*>(data)[i]) * 1099511628211ull;
+	};
+	const double settings[] = { ATLAS_SCALE, ATLAS_PX_RANGE, GlyphAtlas::MITER_LIMIT, GlyphAtlas::CORNER_ANGLE };
+	const uint32_t layout[] = { ATLAS_CACHE_VERSION, GlyphAtlas::SIZE, GlyphAtlas::SPACING, GlyphAtlas::SOLID, TABLE_FIRST_CODEPOINT, TABLE_END_CODEPOINT, (uint32_t) sizeof(AtlasGlyph) };
+	mix(fontData, fontSize);
+	mix(settings, sizeof(settings));
+	mix(layout, sizeof(layout));
+	return hash;
 }
 
-bool loadFont(const std::string& path) {
-	if (msdfgen::FontHandle* font = msdfgen::loadFont(g_AppContext.ft, path.c_str())) {
+std::string atlas_cache_path(uint64_t key) {
+	char name[32];
+	SDL_snprintf(name, sizeof(name), "atlas-%016llx.cache", (unsigned long long) key);
+	char* directory = SDL_GetPrefPath("stb_textedit", "editing_text");
+	if (!directory)
+		return name;
+	std::string path = std::string(directory) + name;
+	SDL_free(directory);
+	return path;
+}
+
+// Writes to a temporary file that then replaces the cache (see replaceFile), so a crash or another
+// instance saving the same font at the same time never leaves a torn cache behind. The temporary
+// name is random, as two instances would otherwise write the same one.
+bool save_atlas_cache(const FontFace& face) {
+	char suffix[32];
+	SDL_snprintf(suffix, sizeof(suffix), ".%08x.tmp", (unsigned) std::random_device()());
+	const std::string temporary = face.cachePath + suffix;
+	std::FILE* file = std::fopen(temporary.c_str(), "wb");
+	if (!file)
+		return false;
+
+	const GlyphTables& tables = face.tables;
+	const AtlasCacheHeader header = { { 'S', 'T', 'B', 'A', 'T', 'L', 'A', 'S' }, ATLAS_CACHE_VERSION, face.cacheKey };
+	std::array<msdf_atlas::unicode_t, 256> codepoints {};
+	for (int c = 0; c < 256; ++c)
+		codepoints[c] = tables.glyph[c] ? tables.glyph[c]->codepoint : 0;
+
+	bool ok = writeValues(file, &header, 1)
+		&& writeValues(file, &face.geometryScale, 1)
+		&& writeValues(file, &tables.fsScale, 1)
+		&& writeValues(file, &tables.lineHeight, 1)
+		&& writeValues(file, tables.advance.data(), LATIN1_GLYPHS)
+		&& writeValues(file, codepoints.data(), codepoints.size())
+		&& writeValues(file, tables.kerning.data(), tables.kerning.size())
+		&& face.atlas.write(file);
+	ok = std::fclose(file) == 0 && ok;
+	ok = ok && replaceFile(temporary, face.cachePath);
+	if (!ok)
+		std::remove(temporary.c_str());
+	return ok;
+}
+
+// Restores the tables and creates the atlas from the cache. Anything short of a complete, matching
+// file is a miss and the caller builds both from the font instead.
+bool load_atlas_cache(FontFace& face) {
+	std::FILE* file = std::fopen(face.cachePath.c_str(), "rb");
+	if (!file)
+		return false;
+
+	GlyphTables& tables = face.tables;
+	AtlasCacheHeader header = {};
+	std::array<msdf_atlas::unicode_t, 256> codepoints {};
+	bool ok = readValues(file, &header, 1)
+		&& std::memcmp(header.magic, "STBATLAS", sizeof(header.magic)) == 0
+		&& header.version == ATLAS_CACHE_VERSION && header.key == face.cacheKey
+		&& readValues(file, &face.geometryScale, 1)
+		&& readValues(file, &tables.fsScale, 1)
+		&& readValues(file, &tables.lineHeight, 1)
+		&& readValues(file, tables.advance.data(), LATIN1_GLYPHS)
+		&& readValues(file, codepoints.data(), codepoints.size())
+		&& readValues(file, tables.kerning.data(), tables.kerning.size());
+	if (ok) {
+		face.atlas.create(face.font, face.geometryScale, ATLAS_SCALE, ATLAS_PX_RANGE);
+		ok = face.atlas.read(file);
+	}
+	std::fclose(file);
+
+	if (ok) {
+		for (int c = 0; c < 256; ++c)
+			tables.glyph[c] = codepoints[c] ? face.atlas.find(codepoints[c]) : nullptr;
+	}
+	return ok;
+}
+
+// Loads the font at path: the metric tables and atlas from the cache, or the Latin-1 outlines
+// for the tables and an empty atlas. Makes no bgfx calls and touches nothing shared but the
+// FreeType library, so it can run on a loading thread while nothing else uses FreeType; the atlas
+// texture appears with the first GlyphAtlas::upload(). nullptr if the file is not a font FreeType
+// can open. This one takes the font file already in memory, e.g. the embedded font, and references
+// fontData for as long as the face lives; path only names the face.
+std::shared_ptr<FontFace> loadFontFace(const std::string& path, const void* fontData, size_t fontSize) {
+	// The bytes are kept for FreeType (loadFontData does not copy them) and hashed for the cache key
+	msdfgen::FontHandle* font = msdfgen::loadFontData(g_AppContext.ft, static_cast<const msdfgen::byte*>(fontData), (int) fontSize);
+	if (!font)
+		return nullptr;
+	auto face = std::make_shared<FontFace>();
+	face->path = path;
+	face->font = font;
+	face->cacheKey = atlas_cache_key(fontData, fontSize);
+	face->cachePath = atlas_cache_path(face->cacheKey);
+	if (g_AppContext.glyphsReady)
+		face->atlas.setNotify(g_AppContext.glyphsReady);
+
+	if (!load_atlas_cache(*face)) {
 		// FontGeometry is a helper class that loads a set of glyphs from a single font.
 		// It can also be used to get additional font metrics, kerning information, etc.
-		g_AppContext.fontGeometry = std::make_unique<msdf_atlas::FontGeometry>(&g_AppContext.glyphs);
-		// Load a set of character glyphs:
-		// The second argument can be ignored unless you mix different font sizes in one atlas.
-		// In the last argument, you can specify a charset other than ASCII.
-		// To load specific glyph indices, use loadGlyphs instead.
-		g_AppContext.fontGeometry->loadCharset(font, 1.0, msdf_atlas::Charset::ASCII);
-		// Apply MSDF edge coloring. See edge-coloring.h for other coloring strategies.
-		const double maxCornerAngle = 3.0;
-		for (msdf_atlas::GlyphGeometry &glyph : g_AppContext.glyphs)
-			glyph.edgeColoring(&msdfgen::edgeColoringInkTrap, maxCornerAngle, 0);
-		// TightAtlasPacker class computes the layout of the atlas.
-		// Set atlas parameters:
-		// setDimensions or setDimensionsConstraint to find the best value
-
-		g_AppContext.packer.setDimensionsConstraint(msdf_atlas::DimensionsConstraint::SQUARE);
-		// setScale for a fixed size or setMinimumScale to use the largest that fits
-		g_AppContext.packer.setMinimumScale(24.0);
-		// setPixelRange or setUnitRange
-		g_AppContext.packer.setPixelRange(2.0);
-		g_AppContext.packer.setMiterLimit(1.0);
-		// Compute atlas layout - pack glyphs
-		g_AppContext.packer.pack(g_AppContext.glyphs.data(), g_AppContext.glyphs.size());
-		// Get final atlas dimensions
-		int width = 0, height = 0;
-		g_AppContext.packer.getDimensions(width, height);
-		// The ImmediateAtlasGenerator class facilitates the generation of the atlas bitmap.
-		AtlasGeneratorType generator(width, height);
-		// GeneratorAttributes can be modified to change the generator's default settings.
-		msdf_atlas::GeneratorAttributes attributes;
-		generator.setAttributes(attributes);
-		generator.setThreadCount(4);
-		// Generate atlas bitmap
-		generator.generate(g_AppContext.glyphs.data(), g_AppContext.glyphs.size());
-		// The atlas bitmap can now be retrieved via atlasStorage as a BitmapConstRef.
-		// The glyphs array (or fontGeometry) contains positioning data for typesetting text.
-		msdfgen::BitmapConstRef<msdfgen::byte, 3> ref = generator.atlasStorage();
-
-		const bgfx::Memory* memory = bgfx::copy(ref.pixels, ref.width * ref.height * 3);
-		g_AppContext.fontAtlas = bgfx::createTexture2D(static_cast<uint16_t>(ref.width), static_cast<uint16_t>(ref.height), false, 1, bgfx::TextureFormat::RGB8, 0, memory);
-
-		msdfgen::destroyFont(font);
-		return true;
+		face->fontGeometry = std::make_unique<msdf_atlas::FontGeometry>(&face->glyphs);
+		// Only outlines, advances and kerning for the metric tables. No distance fields are
+		// generated here, the atlas does that per glyph on first use.
+		msdf_atlas::Charset charset;
+		for (msdf_atlas::unicode_t codepoint = TABLE_FIRST_CODEPOINT; codepoint < TABLE_END_CODEPOINT; ++codepoint)
+			charset.add(codepoint);
+		face->fontGeometry->loadCharset(font, 1.0, charset);
+		face->geometryScale = face->fontGeometry->getGeometryScale();
+
+		// Starts empty and fills up as glyphs are used
+		face->atlas.create(font, face->geometryScale, ATLAS_SCALE, ATLAS_PX_RANGE);
+
+		buildGlyphTables(*face);
 	}
-	return false;
+	update_glyph_corners(*face);
+	return face;
+}
+
+// The same for the font file at path
+std::shared_ptr<FontFace> loadFontFace(const std::string& path) {
+	size_t fontSize = 0;
+	void* fontData = SDL_LoadFile(path.c_str(), &fontSize);
+	if (!fontData)
+		return nullptr;
+
+	std::shared_ptr<FontFace> face = loadFontFace(path, fontData, fontSize);
+	if (face)
+		face->fontData = fontData;
+	else
+		SDL_free(fontData);
+	return face;
 }
 
+// Makes a face from loadFontFace known to acquireFont and pump_font_faces.
+void registerFontFace(const std::shared_ptr<FontFace>& face) {
+	g_AppContext.faces.push_back(face);
+}
+
+// Loads the font at path, or returns the face already loaded from it. nullptr if the file is not
+// a font FreeType can open.
+std::shared_ptr<FontFace> acquireFont(const std::string& path) {
+	std::vector<std::weak_ptr<FontFace>>& faces = g_AppContext.faces;
+	faces.erase(std::remove_if(faces.begin(), faces.end(), [](const std::weak_ptr<FontFace>& face) { return face.expired(); }), faces.end());
+	for (const std::weak_ptr<FontFace>& loaded : faces) {
+		if (std::shared_ptr<FontFace> face = loaded.lock(); face && face->path == path)
+			return face;
+	}
+
+	std::shared_ptr<FontFace> face = loadFontFace(path);
+	if (face)
+		registerFontFace(face);
+	return face;
+}
+
+FontFace::~FontFace() {
+	atlas.pump();
+	if (!cachePath.empty() && atlas.isModified() && !save_atlas_cache(*this))
+		SDL_Log("Atlas cache (%s) could not be written", cachePath.c_str());
+	atlas.destroy(); // joins the generator threads, frees the texture
+	if (font) msdfgen::destroyFont(font);
+	SDL_free(fontData);
+}
+
+// Places the finished glyphs of every loaded face (see GlyphAtlas::pump). Returns true if any text
+// has to be tessellated again. Main thread.
+bool pump_font_faces() {
+	bool changed = false;
+	for (const std::weak_ptr<FontFace>& loaded : g_AppContext.faces) {
+		if (std::shared_ptr<FontFace> face = loaded.lock(); face && face->atlas.pump()) {
+			update_glyph_corners(*face);
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+// Uploads what pump_font_faces placed, for every loaded face. Single-threaded rendering only; the
+// render thread uploads the atlas of the face it draws (see TextEditorApp::drawSnapshot).
+void upload_font_faces() {
+	for (const std::weak_ptr<FontFace>& loaded : g_AppContext.faces) {
+		if (std::shared_ptr<FontFace> face = loaded.lock())
+			face->atlas.upload();
+	}
+}
+
+// Ascender to descender in layout pixels, which fsScale makes FONT_SIZE for every font
 int getFontHeight(text_control* str) {
-	//str->shape.
-	//auto rect = g_AppContext.glyphs[0].getBoxRect();
-	//auto shape = g_AppContext.glyphs[0].getShape();
-	//auto bounds = shape.getBounds();
-	//double l, b, r, t;
-	//g_AppContext.glyphs[0].getQuadPlaneBounds(l, b, r, t);
-	//g_AppContext.glyphs[0].getQuadAtlasBounds(l, b, r, t);
-	//auto spacing = g_AppContext.glyphs[0].getAdvance();
-	// TODO: font knows of font size => return font height
-	return 24; // none return 24, g_AppContext.packer.getScale()
-	//return TTF_GetFontHeight(g_AppContext.font);
-}
-
-void getTextSize(text_control* str, std::string_view text, int* w, int* h) {
-	if (text.empty()) {
-		if (w) *w = 0;
-		if (h) *h = getFontHeight(str);
-		return;
+	return (int) FONT_SIZE;
+}
+
+float getLineHeight(text_control* str) {
+	return (float) str->face->tables.lineHeight;
+}
+
+// Compact MSDF glyph vertex, 16 bytes (was 40): float position, atlas UVs as normalized int16
+// (bgfx has no 16-bit unsigned attribute type; UVs are never negative) and packed ABGR colour.
+// screenPxRange is not stored, fs_msdf_compact derives it from fwidth. Positions stay float
+// because the retained mesh is laid out in document space, which outgrows int16/half precision
+// after a few hundred lines.
+struct GlyphVertex {
+	float x, y;
+	int16_t u, v;
+	uint32_t abgr;
+	static bgfx::VertexLayout s_decl;
+	static void init() {
+		s_decl.begin()
+			.add(bgfx::Attrib::Position, 2, bgfx::AttribType::Float)
+			.add(bgfx::Attrib::TexCoord0, 2, bgfx::AttribType::Int16, true)
+			.add(bgfx::Attrib::Color0, 4, bgfx::AttribType::Uint8, true)
+			.end();
 	}
+};
+bgfx::VertexLayout GlyphVertex::s_decl;
+static_assert(sizeof(GlyphVertex) == 16);
+
+// Uniforms of the MSDF programs: the atlas sampler and u_pxRange, whose x is the distance field
+// range in atlas pixels. fs_msdf_compact turns it into a screen-space range with fwidth, so neither
+// the font size nor the zoom is in the vertices.
+struct GlyphUniforms {
+	bgfx::UniformHandle texture = BGFX_INVALID_HANDLE;
+	bgfx::UniformHandle pxRange = BGFX_INVALID_HANDLE;
+};
 
-	const msdf_atlas::FontGeometry* fontGeometry = g_AppContext.fontGeometry.get();
-	const msdfgen::FontMetrics& metrics = fontGeometry->getMetrics();
+void setGlyphUniforms(const GlyphUniforms& uniforms, const FontFace& face) {
+	const float pxRange[4] = { (float) ATLAS_PX_RANGE, 0.0f, 0.0f, 0.0f };
+	bgfx::setTexture(0, uniforms.texture, face.atlas.getTexture());
+	bgfx::setUniform(uniforms.pxRange, pxRange);
+}
+
+// Draw transform of text laid out with its origin at 0: zoom screen pixels per layout pixel, the
+// origin at (offsetX, offsetY) on screen
+void textTransform(float* transform, float offsetX, float offsetY, float zoom) {
+	bx::mtxSRT(transform, zoom, zoom, 1.0f, 0.0f, 0.0f, 0.0f, offsetX, offsetY, 0.0f);
+}
+
+inline int16_t quantizeUv(double uv) {
+	return (int16_t) std::lround(uv * 32767.0);
+}
 
-	// Scaling factor to convert font units to your desired pixel size (e.g., 24px)
-	double fsScale = 24.0 / (metrics.ascenderY - metrics.descenderY);
-	double lineHeight = fsScale * metrics.lineHeight;
+// Screen-space rectangle (bottom/top already flipped for the y-down view) and normalized atlas
+// rectangle of one glyph drawn with its pen at (x, y).
+struct GlyphQuad {
+	float pl, pb, pr, pt;
+	float al, ab, ar, at;
+};
 
-	double maxWidth = 0.0;
-	double currentLineWidth = 0.0;
-	double totalHeight = getFontHeight(str);
+GlyphQuad getGlyphQuad(const GlyphTables& tables, const AtlasGlyph* glyph, double x, double y) {
+	const double fsScale = tables.fsScale;
 
-	for (size_t i = 0; i < text.length(); ++i) {
-		char character = text[i];
+	double pl = glyph->pl, pb = glyph->pb, pr = glyph->pr, pt = glyph->pt;
+	pl *= fsScale, pb *= fsScale, pr *= fsScale, pt *= fsScale;
+	pl += x, pb = y - pb, pr += x, pt = y - pt;
+	pb += FONT_SIZE, pt += FONT_SIZE;
 
-		if (character == '\n') {
-			maxWidth = std::max(maxWidth, currentLineWidth);
-			currentLineWidth = 0;
-			totalHeight += lineHeight;
-			continue;
-		}
-		else if (character == '\r') {
+	return { (float) pl, (float) pb, (float) pr, (float) pt, glyph->al, glyph->ab, glyph->ar, glyph->at };
+}
+
+// Rebuilds GlyphTables::corners from the atlas records for the glyph ids from first on. Cheap (one
+// entry per glyph in use), done after the font is loaded, for every new glyph_id() and whenever
+// GlyphAtlas::pump reports new glyphs.
+void update_glyph_corners(FontFace& face, uint32_t first) {
+	GlyphTables& tables = face.tables;
+	for (size_t id = first; id < tables.glyph.size(); ++id) {
+		const AtlasGlyph* glyph = tables.glyph[id];
+		GlyphCorners& corners = tables.corners[id];
+		corners = {};
+		tables.pending[id] = glyph && glyph->state == AtlasGlyph::State::Missing;
+		if (!glyph || glyph->state != AtlasGlyph::State::Ready)
 			continue;
-		}
 
-		double advance = 0.0;
-		const msdf_atlas::GlyphGeometry* glyph = fontGeometry->getGlyph(character);
-		if (!glyph) {
-			glyph = fontGeometry->getGlyph('?');
+		const GlyphQuad q = getGlyphQuad(tables, glyph, 0.0, 0.0);
+		auto uv = [](float u, float v) { return (uint32_t) (uint16_t) quantizeUv(u) | (uint32_t) (uint16_t) quantizeUv(v) << 16; };
+		corners = {
+			{ q.pl, q.pr, q.pr, q.pl },
+			{ q.pb, q.pb, q.pt, q.pt },
+			{ uv(q.al, q.ab), uv(q.ar, q.ab), uv(q.ar, q.at), uv(q.al, q.at) },
+		};
+	}
+}
+
+// One glyph quad: pen + corner offsets, interleaved with the packed UVs and the colour into four
+// 16-byte vertices, i.e. one SIMD register per vertex.
+inline void writeGlyphCorners(GlyphVertex* out, const GlyphCorners& corners, float x, float y, uint32_t abgr) {
+#if defined(GLYPH_KERNEL_SSE2)
+	__m128 px = _mm_add_ps(_mm_set1_ps(x), _mm_load_ps(corners.x));
+	__m128 py = _mm_add_ps(_mm_set1_ps(y), _mm_load_ps(corners.y));
+	__m128 uv = _mm_load_ps(reinterpret_cast<const float*>(corners.uv));
+	__m128 colour = _mm_castsi128_ps(_mm_set1_epi32((int) abgr));
+	_MM_TRANSPOSE4_PS(px, py, uv, colour); // shuffles only, the UV and colour bits pass unchanged
+	float* data = reinterpret_cast<float*>(out);
+	_mm_storeu_ps(data + 0, px);
+	_mm_storeu_ps(data + 4, py);
+	_mm_storeu_ps(data + 8, uv);
+	_mm_storeu_ps(data + 12, colour);
+#elif defined(GLYPH_KERNEL_NEON)
+	float32x4x4_t vertices;
+	vertices.val[0] = vaddq_f32(vdupq_n_f32(x), vld1q_f32(corners.x));
+	vertices.val[1] = vaddq_f32(vdupq_n_f32(y), vld1q_f32(corners.y));
+	vertices.val[2] = vreinterpretq_f32_u32(vld1q_u32(corners.uv));
+	vertices.val[3] = vreinterpretq_f32_u32(vdupq_n_u32(abgr));
+	vst4q_f32(reinterpret_cast<float*>(out), vertices); // interleaving store
+#else
+	for (int k = 0; k < 4; ++k) {
+		out[k] = { x + corners.x[k], y + corners.y[k], (int16_t) (corners.uv[k] & 0xffff), (int16_t) (corners.uv[k] >> 16), abgr };
+	}
+#endif
+}
+
+// Writes the quads of count consecutive characters, four vertices per character, to data. glyphs
+// holds their glyph ids (the bytes themselves for ASCII text) and penX their line offsets;
+// characters without a ready glyph get a degenerate quad at the pen, so every character keeps its
+// slot. Four characters per iteration. Touches no shared state, so it can run on any thread;
+// returns whether a character's glyph still has to be requested, which request_pending_glyphs does
+// on the main thread.
+template <typename Glyph>
+bool writeGlyphQuadRun(const GlyphTables& tables, GlyphVertex* data, const Glyph* glyphs, const float* penX, size_t count, float offsetX, float y, uint32_t abgr = 0xff000000) {
+	const GlyphCorners* corners = tables.corners.data();
+	const uint8_t* pendingOf = tables.pending.data();
+	uint8_t pending = 0;
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4, data += 16) {
+		pending |= pendingOf[glyphs[i]] | pendingOf[glyphs[i + 1]] | pendingOf[glyphs[i + 2]] | pendingOf[glyphs[i + 3]];
+		writeGlyphCorners(data + 0, corners[glyphs[i + 0]], offsetX + penX[i + 0], y, abgr);
+		writeGlyphCorners(data + 4, corners[glyphs[i + 1]], offsetX + penX[i + 1], y, abgr);
+		writeGlyphCorners(data + 8, corners[glyphs[i + 2]], offsetX + penX[i + 2], y, abgr);
+		writeGlyphCorners(data + 12, corners[glyphs[i + 3]], offsetX + penX[i + 3], y, abgr);
+	}
+	for (; i < count; ++i, data += 4) {
+		pending |= pendingOf[glyphs[i]];
+		writeGlyphCorners(data, corners[glyphs[i]], offsetX + penX[i], y, abgr);
+	}
+
+	return pending != 0;
+}
+
+// Queues generation of the glyphs writeGlyphQuadRun found missing, like drawable_glyph does.
+template <typename Glyph>
+void request_pending_glyphs(FontFace& face, const Glyph* glyphs, size_t count) {
+	GlyphTables& tables = face.tables;
+	for (size_t j = 0; j < count; ++j) {
+		if (tables.pending[glyphs[j]]) {
+			drawable_glyph(face, glyphs[j]);
+			tables.pending[glyphs[j]] = 0;
 		}
-		if (!glyph) {
-			continue;
+	}
+}
+
+// Calls fn(const unsigned char* chars, const uint32_t* glyphs, const float* penX, size_t count) for
+// the pieces of [begin, end), which is part of one line, that are contiguous in the storage; penX
+// points into the line's offsets, which are contiguous throughout. A storage span
+// that is all ASCII (checked 16 bytes at a time) is passed as chars, its bytes being the glyph ids,
+// and glyphs is nullptr; any other span is decoded to glyph ids in the frame arena and chars is
+// nullptr.
+template <typename Fn>
+void for_each_glyph_span(text_control* str, int begin, int end, Fn&& fn) {
+	const size_t first = str->index.byteOf(str->string, begin);
+	const size_t last = str->index.byteOf(str->string, end);
+	const int line = line_of(str, begin);
+	const float* penX = line_prefix_x(str, line) + (begin - str->line_starts[line]);
+	str->string.forEachSpan(first, last - first, [&](const char* span, size_t spanLength) {
+		const unsigned char* chars = reinterpret_cast<const unsigned char*>(span);
+		const uint32_t* glyphs = nullptr;
+		size_t count = spanLength;
+		if (!utf8_is_ascii(span, spanLength)) {
+			uint32_t* decoded = g_AppContext.frame.allocate<uint32_t>(spanLength);
+			count = utf8_glyphs(*str->face, span, spanLength, decoded);
+			chars = nullptr;
+			glyphs = decoded;
 		}
+		fn(chars, glyphs, penX, count);
+		penX += count;
+	});
+}
 
-		advance = glyph->getAdvance();
+// A piece of a visible run that is contiguous in the storage, with the quad slot of its first
+// character and the pen position of its line start. Either chars (ASCII bytes) or glyphs
+// (glyph ids) is set, see for_each_glyph_span.
+struct GlyphSpan {
+	const unsigned char* chars;
+	const uint32_t* glyphs;
+	const float* penX;
+	uint32_t count;
+	uint32_t slot;
+	float x, y;
+};
 
-		if (i < text.length() - 1) {
-			char nextCharacter = text[i + 1];
-			fontGeometry->getAdvance(advance, character, nextCharacter);
-		}
+// Resolves [begin, end) of a line starting at (x, y) into spans taking consecutive slots from slot,
+// at most maxSlot in total. Returns the next free slot.
+template <typename Spans>
+uint32_t collect_glyph_spans(text_control* str, int begin, int end, float x, float y, uint32_t slot, Spans& spans, uint32_t maxSlot = UINT32_MAX) {
+	for_each_glyph_span(str, begin, end, [&](const unsigned char* chars, const uint32_t* glyphs, const float* penX, size_t count) {
+		count = std::min<size_t>(count, maxSlot - slot);
+		if (count == 0)
+			return;
+		spans.push_back(GlyphSpan { chars, glyphs, penX, (uint32_t) count, slot, x, y });
+		slot += (uint32_t) count;
+	});
+	return slot;
+}
 
-		currentLineWidth += fsScale * advance;
-	}
+// Screens of dense text are split between the job pool's threads; below this many quads the
+// hand-off costs more than it saves
+constexpr uint32_t PARALLEL_MIN_QUADS = 4096;
+constexpr uint32_t SPANS_PER_JOB = 16;
 
-	maxWidth = std::max(maxWidth, currentLineWidth);
+// Fills the quad slots of spans in data (four vertices per slot). The spans only point at memory
+// resolved on the main thread, so the kernel runs on the workers without touching the storage's
+// caches; glyph requests wait until the join.
+void tessellate_glyph_spans(FontFace& face, GlyphVertex* data, const GlyphSpan* spans, size_t count) {
+	if (count == 0)
+		return;
 
-	if (w) *w = static_cast<int>(ceil(maxWidth));
-	if (h) *h = static_cast<int>(ceil(totalHeight));
+	const uint32_t quads = spans[count - 1].slot + spans[count - 1].count - spans[0].slot;
+	uint8_t* pending = g_AppContext.frame.allocate<uint8_t>(count);
+	auto tessellate = [&](uint32_t begin, uint32_t end) {
+		for (uint32_t k = begin; k < end; ++k) {
+			const GlyphSpan& span = spans[k];
+			GlyphVertex* quads = data + 4 * span.slot;
+			pending[k] = span.chars ? writeGlyphQuadRun(face.tables, quads, span.chars, span.penX, span.count, span.x, span.y)
+				: writeGlyphQuadRun(face.tables, quads, span.glyphs, span.penX, span.count, span.x, span.y);
+		}
+	};
+	if (quads >= PARALLEL_MIN_QUADS)
+		g_AppContext.jobs.parallelFor((uint32_t) count, SPANS_PER_JOB, tessellate);
+	else
+		tessellate(0, (uint32_t) count);
+
+	for (size_t k = 0; k < count; ++k) {
+		if (pending[k] && spans[k].chars)
+			request_pending_glyphs(face, spans[k].chars, spans[k].count);
+		else if (pending[k])
+			request_pending_glyphs(face, spans[k].glyphs, spans[k].count);
+	}
 }
 
-struct TextLayoutFormat
-{
-	std::array<float, 2> pos;
-	std::array<float, 2> texCoords;
-	std::array<float, 2> screenPxRange;
-	std::array<float, 4> colour;
+// Rectangle of the screen, in text-local pixels, for text whose origin is drawn at (offsetX, offsetY).
+struct TextViewport {
+	float left, top, right, bottom;
 };
 
-void createTextTexture(float offsetX, float offsetY, text_control* str, std::string_view strView, bgfx::VertexLayout layout, bgfx::ProgramHandle program, bgfx::UniformHandle tex_uniform) {
-	const msdf_atlas::FontGeometry* fontGeometry = g_AppContext.fontGeometry.get();
-	const msdfgen::FontMetrics& metrics = fontGeometry->getMetrics();
-	const msdf_atlas::TightAtlasPacker& atlasPacker = g_AppContext.packer;
+TextViewport text_viewport(float offsetX, float offsetY, float zoom = 1.0f) {
+	return { -offsetX / zoom, -offsetY / zoom, (g_AppContext.viewWidth - offsetX) / zoom, (g_AppContext.viewHeight - offsetY) / zoom };
+}
 
-	double x = offsetX;
-	double fsScale = 24.0 / (metrics.ascenderY - metrics.descenderY);
-	double y = offsetY;
+// The same for a rectangle of the screen, e.g. the box of a text field
+TextViewport text_viewport(float offsetX, float offsetY, float left, float top, float right, float bottom) {
+	return { left - offsetX, top - offsetY, right - offsetX, bottom - offsetY };
+}
 
-	const float spaceGlyphAdvance = fontGeometry->getGlyph(' ')->getAdvance();
+// Smallest i in [lo, hi) with prefix[i] >= x, or hi. The offsets only grow along a line.
+int lower_bound_x(const float* prefix, int lo, int hi, float x) {
+	while (lo < hi) {
+		const int mid = (lo + hi) / 2;
+		if (prefix[mid] < x)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
 
-	int maxIndices = 6;
-	int maxVertices = 4;
-	bgfx::TransientIndexBuffer indexBuffer;
-	bgfx::TransientVertexBuffer vertexBuffer;
-	bgfx::allocTransientIndexBuffer(&indexBuffer, maxIndices * strView.length());
-	bgfx::allocTransientVertexBuffer(&vertexBuffer, maxVertices * strView.length(), layout);
+// Calls fn(int line, int begin, int end) for every line intersecting the viewport with the range of
+// its characters that can be visible. Lines come from the line table and the horizontal range from
+// a binary search of its offsets, so the cost depends on what is on screen, not on the document size.
+// Glyph ink may overhang its advance, hence the one font height of slack on either side.
+template <typename Fn>
+void for_each_visible_run(text_control* str, const TextViewport& view, Fn&& fn) {
+	const float lineHeight = getLineHeight(str);
+	const int lines = (int) str->line_starts.size();
+	if (lineHeight <= 0.0f || view.bottom <= 0.0f)
+		return;
 
-	uint16_t* indexData = (uint16_t*) indexBuffer.data;
+	const int first = std::max(0, (int) std::floor(view.top / lineHeight));
+	const int last = std::min(lines - 1, (int) std::floor(view.bottom / lineHeight));
+	const float slack = (float) getFontHeight(str);
 
-	auto* data = (TextLayoutFormat*) vertexBuffer.data;
-	int numVerts = 0;
-	int numIndices = 0;
+	for (int line = first; line <= last; ++line) {
+		const int start = str->line_starts[line];
+		const int end = line_end(str, line) - start;
+		const float* x = line_prefix_x(str, line);
+		const int begin = std::max(0, lower_bound_x(x, 1, end + 1, view.left - slack) - 1);
+		fn(line, start + begin, start + lower_bound_x(x, begin, end, view.right + slack));
+	}
+}
 
-	for (size_t i = 0; i < strView.size(); i++)
-	{
-		char character = strView[i];
-		if (character == '\r')
-			continue;
+// Retained glyph mesh over a window of the document: the viewport plus OVERSCAN pixels on every
+// side, laid out in document space and scrolled and zoomed with a transform, so scrolling inside
+// the window or zooming in costs nothing. Every character of the window's visible runs owns one quad slot (left empty for
+// whitespace), in line order; an edit re-tessellates and uploads the window from the edited line
+// onward, and the window is rebuilt when the viewport leaves it.
+struct TextMesh {
+	static constexpr uint32_t QUADS_PER_DRAW = 16384; // 16-bit indices address 65536 vertices
+	static constexpr float OVERSCAN = 512.0f; // layout pixels
+
+	bgfx::DynamicVertexBufferHandle vertices = BGFX_INVALID_HANDLE;
+	bgfx::IndexBufferHandle indices = BGFX_INVALID_HANDLE; // shared quad pattern, QUADS_PER_DRAW quads
+	size_t capacity = 0; // quads
+
+	TextViewport window = { 0.0f, 0.0f, -1.0f, -1.0f }; // empty until the first update
+	int first_line = 0;
+	std::vector<uint32_t> line_slots; // first slot of each window line, then the total quad count
+};
 
-		if (character == '\n')
-		{
-			x = 0;
-			y -= fsScale * metrics.lineHeight;
-			continue;
-		}
+// Static index buffer of the fixed quad pattern (0 1 2, 2 3 0 per quad), shared by every draw
+// of up to quads quads
+bgfx::IndexBufferHandle createQuadIndexBuffer(uint32_t quads) {
+	const bgfx::Memory* memory = bgfx::alloc(quads * 6 * sizeof(uint16_t));
+	uint16_t* indexData = (uint16_t*) memory->data;
+	for (uint32_t quad = 0; quad < quads; ++quad) {
+		const uint16_t baseVert = (uint16_t) (quad * 4);
+		*indexData++ = baseVert + 0;
+		*indexData++ = baseVert + 1;
+		*indexData++ = baseVert + 2;
+		*indexData++ = baseVert + 2;
+		*indexData++ = baseVert + 3;
+		*indexData++ = baseVert + 0;
+	}
+	return bgfx::createIndexBuffer(memory);
+}
 
-		if (character == ' ')
-		{
-			float advance = spaceGlyphAdvance;
-			if (i < strView.size() - 1)
-			{
-				char nextCharacter = strView[i + 1];
-				double dAdvance;
-				fontGeometry->getAdvance(dAdvance, character, nextCharacter);
-				advance = (float)dAdvance;
-			}
+// For the text origin at (offsetX, offsetY) on screen, drawn at zoom
+void updateTextMesh(TextMesh& mesh, text_control* str, float offsetX, float offsetY, float zoom = 1.0f) {
+	ProfileScope scope(g_AppContext.profiler, "updateTextMesh");
+	const TextViewport view = text_viewport(offsetX, offsetY, zoom);
 
-			x += fsScale * advance;
-			continue;
+	if (!bgfx::isValid(mesh.indices))
+		mesh.indices = createQuadIndexBuffer(TextMesh::QUADS_PER_DRAW);
+
+	const bool inside = view.left >= mesh.window.left && view.right <= mesh.window.right
+		&& view.top >= mesh.window.top && view.bottom <= mesh.window.bottom;
+	if (inside && str->mesh_dirty_from == SIZE_MAX)
+		return;
+
+	if (!inside) {
+		mesh.window = { view.left - TextMesh::OVERSCAN, view.top - TextMesh::OVERSCAN, view.right + TextMesh::OVERSCAN, view.bottom + TextMesh::OVERSCAN };
+		mesh.line_slots.clear();
+	}
+
+	// Visible runs of the window from the first line that changed. Earlier lines keep their slots;
+	// an edit above the window shifts every line in it, so that rebuilds the whole window.
+	const size_t dirty = std::min(str->mesh_dirty_from, str->index.size());
+	str->mesh_dirty_from = SIZE_MAX;
+	FrameVector<std::pair<int, int>> runs(g_AppContext.frame);
+	int from_line = -1;
+	for_each_visible_run(str, mesh.window, [&](int line, int begin, int end) {
+		if (from_line < 0) {
+			if (line != mesh.first_line)
+				mesh.line_slots.clear();
+			mesh.first_line = line;
+			from_line = mesh.line_slots.empty() ? line : std::clamp(line_of(str, (int) dirty), line, line + (int) mesh.line_slots.size() - 1);
+			mesh.line_slots.resize(from_line - line + 1, 0);
 		}
+		if (line >= from_line)
+			runs.push_back({ begin, end });
+	});
+	if (from_line < 0) {
+		mesh.line_slots.assign(1, 0);
+		return;
+	}
 
-		if (character == '\t')
-		{
-			// NOTE(Yan): is this right?
-			x += 4.0f * (fsScale * spaceGlyphAdvance);
-			continue;
+	uint32_t slot = mesh.line_slots.back();
+	const uint32_t firstSlot = slot;
+	for (const auto& [begin, end] : runs)
+		mesh.line_slots.push_back(slot += end - begin);
+
+	if (slot > mesh.capacity) {
+		if (bgfx::isValid(mesh.vertices)) bgfx::destroy(mesh.vertices);
+		mesh.capacity = std::max<size_t>({ slot, mesh.capacity * 2, 1024 });
+		mesh.vertices = bgfx::createDynamicVertexBuffer((uint32_t) (mesh.capacity * 4), GlyphVertex::s_decl);
+		if (firstSlot > 0) {
+			// The old contents are gone, tessellate the whole window again
+			mesh.window = { 0.0f, 0.0f, -1.0f, -1.0f };
+			str->mesh_dirty_from = 0;
+			updateTextMesh(mesh, str, offsetX, offsetY, zoom);
+			return;
 		}
+	}
 
-		auto glyph = fontGeometry->getGlyph(character);
-		if (!glyph)
-			glyph = fontGeometry->getGlyph('?');
-		if (!glyph)
-			continue;
+	if (slot == firstSlot)
+		return;
 
-		double al, ab, ar, at;
-		glyph->getQuadAtlasBounds(al, ab, ar, at);
-
-		double pl, pb, pr, pt;
-		glyph->getQuadPlaneBounds(pl, pb, pr, pt);
-
-		pl *= fsScale, pb *= fsScale, pr *= fsScale, pt *= fsScale;
-		pl += x, pb = y - pb, pr += x, pt = y - pt;
-		pb += 24, pt += 24;
-
-		int width;
-		int height;
-		atlasPacker.getDimensions(width, height);
-		float texelWidth = 1.0f / width;
-		float texelHeight = 1.0f / height;
-		al *= texelWidth, ab *= texelHeight, ar *= texelWidth, at *= texelHeight;
-
-		// render here
-		int baseVert = numVerts;
-		// 0
-		data[numVerts].pos[0] = pl;
-		data[numVerts].pos[1] = pb;
-		data[numVerts].texCoords[0] = al;
-		data[numVerts].texCoords[1] = ab;
-		data[numVerts].screenPxRange[0] = (pt - pb) * SCREEN_HEIGHT;
-		data[numVerts].screenPxRange[1] = (pt - pb) * SCREEN_HEIGHT;
-		data[numVerts].colour[0] = 0.0;
-		data[numVerts].colour[1] = 0.0;
-		data[numVerts].colour[2] = 0.0;
-		data[numVerts].colour[3] = 1.0;
-		numVerts++;
-
-		// 1
-		data[numVerts].pos[0] = pr;
-		data[numVerts].pos[1] = pb;
-		data[numVerts].texCoords[0] = ar;
-		data[numVerts].texCoords[1] = ab;
-		data[numVerts].screenPxRange[0] = (pt - pb) * SCREEN_HEIGHT;
-		data[numVerts].screenPxRange[1] = (pt - pb) * SCREEN_HEIGHT;
-		data[numVerts].colour[0] = 0.0;
-		data[numVerts].colour[1] = 0.0;
-		data[numVerts].colour[2] = 0.0;
-		data[numVerts].colour[3] = 1.0;
-		numVerts++;
-
-		// 2
-		data[numVerts].pos[0] = pr;
-		data[numVerts].pos[1] = pt;
-		data[numVerts].texCoords[0] = ar;
-		data[numVerts].texCoords[1] = at;
-		data[numVerts].screenPxRange[0] = (pt - pb) * SCREEN_HEIGHT;
-		data[numVerts].screenPxRange[1] = (pt - pb) * SCREEN_HEIGHT;
-		data[numVerts].colour[0] = 0.0;
-		data[numVerts].colour[1] = 0.0;
-		data[numVerts].colour[2] = 0.0;
-		data[numVerts].colour[3] = 1.0;
-		numVerts++;
-
-		// 4
-		data[numVerts].pos[0] = pl;
-		data[numVerts].pos[1] = pt;
-		data[numVerts].texCoords[0] = al;
-		data[numVerts].texCoords[1] = at;
-		data[numVerts].screenPxRange[0] = (pt - pb) * SCREEN_HEIGHT;
-		data[numVerts].screenPxRange[1] = (pt - pb) * SCREEN_HEIGHT;
-		data[numVerts].colour[0] = 0.0;
-		data[numVerts].colour[1] = 0.0;
-		data[numVerts].colour[2] = 0.0;
-		data[numVerts].colour[3] = 1.0;
-		numVerts++;
-
-		indexData[numIndices++] = baseVert + 0;
-		indexData[numIndices++] = baseVert + 1;
-		indexData[numIndices++] = baseVert + 2;
-
-		indexData[numIndices++] = baseVert + 2;
-		indexData[numIndices++] = baseVert + 3;
-		indexData[numIndices++] = baseVert + 0;
-
-		if (i < strView.size() - 1)
-		{
-			double advance = glyph->getAdvance();
-			char nextCharacter = strView[i + 1];
-			fontGeometry->getAdvance(advance, character, nextCharacter);
+	// The frame arena keeps the vertices alive as long as bgfx reads them, so there is no copy
+	const uint32_t bytes = (slot - firstSlot) * 4 * sizeof(GlyphVertex);
+	auto* data = (GlyphVertex*) g_AppContext.frame.allocate(bytes, alignof(GlyphVertex));
 
-			x += fsScale * advance;
-		}
+	const float lineHeight = getLineHeight(str);
+	FrameVector<GlyphSpan> spans(g_AppContext.frame);
+	spans.reserve(runs.size());
+	uint32_t next = 0;
+	int line = from_line;
+	for (const auto& [begin, end] : runs)
+		next = collect_glyph_spans(str, begin, end, 0.0f, line++ * lineHeight, next, spans);
+	tessellate_glyph_spans(*str->face, data, spans.data(), spans.size());
+
+	bgfx::update(mesh.vertices, firstSlot * 4, bgfx::makeRef(data, bytes));
+}
+
+void drawTextMesh(const TextMesh& mesh, const FontFace& face, float offsetX, float offsetY, float zoom, bgfx::ProgramHandle program, const GlyphUniforms& uniforms) {
+	const uint32_t quads = mesh.line_slots.empty() ? 0 : mesh.line_slots.back();
+	float transform[16];
+	textTransform(transform, offsetX, offsetY, zoom);
+	for (uint32_t first = 0; first < quads; first += TextMesh::QUADS_PER_DRAW) {
+		const uint32_t count = std::min(quads - first, TextMesh::QUADS_PER_DRAW);
+		bgfx::setTransform(transform);
+		bgfx::setVertexBuffer(0, mesh.vertices, first * 4, count * 4);
+		bgfx::setIndexBuffer(mesh.indices, 0, count * 6);
+		setGlyphUniforms(uniforms, face);
+		bgfx::setState(BGFX_STATE_WRITE_RGB | BGFX_STATE_WRITE_A | BGFX_STATE_MSAA | BGFX_STATE_BLEND_NORMAL);
+		bgfx::submit(0, program);
 	}
+}
 
-	if (numVerts > 0)
-	{
-		bgfx::setIndexBuffer(&indexBuffer, 0, numIndices);
-		bgfx::setVertexBuffer(0, &vertexBuffer, 0, numVerts);
-		bgfx::setTexture(0, tex_uniform, g_AppContext.fontAtlas);
+void destroyTextMesh(TextMesh& mesh) {
+	if (bgfx::isValid(mesh.vertices)) bgfx::destroy(mesh.vertices);
+	if (bgfx::isValid(mesh.indices)) bgfx::destroy(mesh.indices);
+	mesh = TextMesh();
+}
+
+// Immediate mode text: the visible runs of any number of text_controls that share a face, e.g. a
+// screen of text fields, re-tessellated into one transient buffer every frame and drawn with one
+// submit (per QUADS_PER_DRAW quads) however many controls went in. A text_control costs its own
+// state and text, the face's tables and atlas are shared. The spans point into the controls'
+// storage and line offsets, so none of them may be edited between addTextToBatch and submitTextBatch. The batch is
+// drawn at the zoom given to submitTextBatch, so offsets and views are screen pixels over the zoom.
+struct TextBatch {
+	static constexpr uint32_t QUADS_PER_DRAW = TextMesh::QUADS_PER_DRAW;
+
+	FontFace* face = nullptr; // of everything added since the last submit
+	std::vector<GlyphSpan> spans;
+	uint32_t quads = 0;
+	bgfx::IndexBufferHandle indices = BGFX_INVALID_HANDLE; // shared quad pattern
+};
+
+// Adds the runs of str inside view (text-local, see text_viewport) for its origin at
+// (offsetX, offsetY). Returns false, adding nothing, if str uses another face than the batch;
+// that text needs a batch of its own.
+bool addTextToBatch(TextBatch& batch, text_control* str, float offsetX, float offsetY, const TextViewport& view) {
+	if (batch.face && batch.face != str->face.get())
+		return false;
+	batch.face = str->face.get();
+
+	// Every visible character gets a quad slot (degenerate for whitespace), so the indices follow the
+	// fixed quad pattern and the runs can be tessellated independently
+	const float lineHeight = getLineHeight(str);
+	for_each_visible_run(str, view, [&](int line, int begin, int end) {
+		batch.quads = collect_glyph_spans(str, begin, end, offsetX, offsetY + line * lineHeight, batch.quads, batch.spans);
+	});
+	return true;
+}
+
+// Tessellates the first quads quads of the batch, four vertices each; the rest is dropped. Makes no
+// bgfx calls.
+void tessellateTextBatch(TextBatch& batch, uint32_t quads, GlyphVertex* vertices) {
+	while (!batch.spans.empty() && batch.spans.back().slot >= quads)
+		batch.spans.pop_back();
+	if (!batch.spans.empty())
+		batch.spans.back().count = std::min(batch.spans.back().count, quads - batch.spans.back().slot);
+	tessellate_glyph_spans(*batch.face, vertices, batch.spans.data(), batch.spans.size());
+}
+
+void clearTextBatch(TextBatch& batch) {
+	batch.face = nullptr;
+	batch.spans.clear();
+	batch.quads = 0;
+}
+
+// Draws quads glyph quads of face from a transient buffer, QUADS_PER_DRAW per submit over the
+// shared quad index buffer
+void drawGlyphQuads(const bgfx::TransientVertexBuffer& vertexBuffer, uint32_t quads, bgfx::IndexBufferHandle indices, const FontFace& face, float zoom, bgfx::ProgramHandle program, const GlyphUniforms& uniforms) {
+	float transform[16];
+	textTransform(transform, 0.0f, 0.0f, zoom);
+	for (uint32_t first = 0; first < quads; first += TextBatch::QUADS_PER_DRAW) {
+		const uint32_t count = std::min(quads - first, TextBatch::QUADS_PER_DRAW);
+		bgfx::setTransform(transform);
+		bgfx::setVertexBuffer(0, &vertexBuffer, first * 4, count * 4);
+		bgfx::setIndexBuffer(indices, 0, count * 6);
+		setGlyphUniforms(uniforms, face);
 		bgfx::setState(BGFX_STATE_WRITE_RGB | BGFX_STATE_WRITE_A | BGFX_STATE_MSAA | BGFX_STATE_BLEND_NORMAL);
 		bgfx::submit(0, program);
 	}
 }
 
+// A solid rectangle in screen pixels: a selection line, a search highlight, the caret
+struct SolidRect {
+	float x, y, w, h;
+	uint32_t abgr;
+};
+
+// The solid rectangles of a frame, under the text and over it. They are glyph quads over the
+// atlas's solid block (GlyphAtlas::SOLID), drawn with the text's program and uniforms, so they go
+// into the text's transient buffer and draws and cost no draw call of their own however many there
+// are. The arrays are the caller's.
+struct Decorations {
+	const SolidRect* under = nullptr; // current line, search matches, selection
+	uint32_t underCount = 0;
+	const SolidRect* over = nullptr;  // caret
+	uint32_t overCount = 0;
+};
+
+// Four glyph vertices per rectangle, mapped onto the solid block, for a draw at zoom
+void tessellateDecorations(const SolidRect* rects, uint32_t count, float zoom, GlyphVertex* vertices) {
+	const int16_t uv0 = quantizeUv(GlyphAtlas::SOLID_UV0), uv1 = quantizeUv(GlyphAtlas::SOLID_UV1);
+	for (uint32_t i = 0; i < count; ++i, vertices += 4) {
+		const SolidRect& r = rects[i];
+		const float x0 = r.x / zoom, y0 = r.y / zoom, x1 = (r.x + r.w) / zoom, y1 = (r.y + r.h) / zoom;
+		vertices[0] = { x0, y0, uv0, uv0, r.abgr };
+		vertices[1] = { x1, y0, uv1, uv0, r.abgr };
+		vertices[2] = { x1, y1, uv1, uv1, r.abgr };
+		vertices[3] = { x0, y1, uv0, uv1, r.abgr };
+	}
+}
+
+// Draws decorations.under, then quads quads that text(GlyphVertex* vertices, uint32_t quads) writes,
+// then decorations.over, from one transient buffer with drawGlyphQuads. Whatever the transient buffer
+// cannot take this frame is dropped, the text before the decorations.
+template <typename Text>
+void drawDecoratedQuads(const Decorations& decorations, uint32_t quads, Text&& text, bgfx::IndexBufferHandle indices, const FontFace& face, float zoom, bgfx::ProgramHandle program, const GlyphUniforms& uniforms) {
+	const uint32_t solid = decorations.underCount + decorations.overCount;
+	const uint32_t available = bgfx::getAvailTransientVertexBuffer((solid + quads) * 4, GlyphVertex::s_decl) / 4;
+	if (solid + quads == 0 || available < solid)
+		return;
+	quads = std::min(quads, available - solid);
+	bgfx::TransientVertexBuffer vertexBuffer;
+	bgfx::allocTransientVertexBuffer(&vertexBuffer, (solid + quads) * 4, GlyphVertex::s_decl);
+	GlyphVertex* vertices = (GlyphVertex*) vertexBuffer.data;
+	tessellateDecorations(decorations.under, decorations.underCount, zoom, vertices);
+	if (quads > 0)
+		text(vertices + decorations.underCount * 4, quads);
+	tessellateDecorations(decorations.over, decorations.overCount, zoom, vertices + (decorations.underCount + quads) * 4);
+	drawGlyphQuads(vertexBuffer, solid + quads, indices, face, zoom, program, uniforms);
+}
+
+// Decorations alone, for text drawn from a buffer of its own (TextMesh, instancing)
+void drawDecorations(const Decorations& decorations, bgfx::IndexBufferHandle indices, const FontFace& face, bgfx::ProgramHandle program, const GlyphUniforms& uniforms) {
+	drawDecoratedQuads(decorations, 0, [](GlyphVertex*, uint32_t) {}, indices, face, 1.0f, program, uniforms);
+}
+
+// Draws and empties the batch, with the decorations in the same buffer and draws. An empty batch
+// has no face, the decorations are then drawn over face's atlas (any atlas has the solid block).
+void submitTextBatch(TextBatch& batch, bgfx::ProgramHandle program, const GlyphUniforms& uniforms, float zoom = 1.0f, const Decorations& decorations = Decorations(), const FontFace* face = nullptr) {
+	ProfileScope scope(g_AppContext.profiler, "submitTextBatch");
+	if (!bgfx::isValid(batch.indices))
+		batch.indices = createQuadIndexBuffer(TextBatch::QUADS_PER_DRAW);
+
+	if (batch.face)
+		face = batch.face;
+	if (face) {
+		drawDecoratedQuads(decorations, batch.quads, [&](GlyphVertex* vertices, uint32_t quads) {
+			tessellateTextBatch(batch, quads, vertices);
+		}, batch.indices, *face, zoom, program, uniforms);
+	}
+	clearTextBatch(batch);
+}
+
+void destroyTextBatch(TextBatch& batch) {
+	if (bgfx::isValid(batch.indices)) bgfx::destroy(batch.indices);
+	batch = TextBatch();
+}
 
+// One row per line, answered from the line table and the line's offsets without walking the text.
 void layout_func(StbTexteditRow *row, text_control *str, int start_i) {
-	if (!g_AppContext.ft) return;
-	const int remaining_chars = str->string.length() - start_i;
-	int width = 0;
-	getTextSize(str, std::string_view(str->string.data() + start_i, remaining_chars), &width, nullptr);
+	const int line = line_of(str, start_i);
+	const int start = str->line_starts[line];
+	const int next_start = line + 1 < (int) str->line_starts.size() ? str->line_starts[line + 1] : (int) str->index.size();
+	const float* x = line_prefix_x(str, line);
 	row->x0 = 0.0f;
-	row->x1 = (float)width;
-	row->baseline_y_delta = (float) getFontHeight(str);
+	row->x1 = x[line_end(str, line) - start] - x[start_i - start];
+	row->baseline_y_delta = getLineHeight(str);
 	row->ymin = 0.0f;
-	row->ymax = (float) getFontHeight(str);
-	row->num_chars = remaining_chars;
+	row->ymax = getLineHeight(str);
+	row->num_chars = next_start - start_i;
 }
 
-// --- BGFX Rendering Details ---
-// Simple vertex format for 2D rendering
-struct PosColorVertex {
-	float x, y;
-	uint32_t abgr;
-	static bgfx::VertexLayout s_decl;
-	static void init() {
-		s_decl.begin()
-			.add(bgfx::Attrib::Position, 2, bgfx::AttribType::Float)
-			.add(bgfx::Attrib::Color0, 4, bgfx::AttribType::Uint8, true)
-			.end();
+// Maps a point relative to the text origin to a character position with the same rules as
+// stb_text_locate_coord, but picks the line directly and binary searches its offsets.
+int locate_coord(text_control *str, float x, float y) {
+	const int lines = (int) str->line_starts.size();
+	const int line = std::clamp((int) std::floor(y / getLineHeight(str)), 0, lines - 1);
+	const float* prefix = line_prefix_x(str, line);
+
+	const int start = str->line_starts[line];
+	int lo = 0;
+	int hi = line_end(str, line) - start;
+	while (lo < hi) {
+		const int mid = (lo + hi) / 2;
+		if (x < 0.5f * (prefix[mid] + prefix[mid + 1]))
+			hi = mid;
+		else
+			lo = mid + 1;
 	}
-};
-bgfx::VertexLayout PosColorVertex::s_decl;
+	return start + lo;
+}
 
+// Same state changes as stb_textedit_click/stb_textedit_drag, using locate_coord for the hit test.
+void text_click(text_control *str, float x, float y) {
+	str->state.cursor = locate_coord(str, x, y);
+	str->state.select_start = str->state.cursor;
+	str->state.select_end = str->state.cursor;
+	str->state.has_preferred_x = 0;
+}
+
+void text_drag(text_control *str, float x, float y) {
+	if (str->state.select_start == str->state.select_end)
+		str->state.select_start = str->state.cursor;
+	str->state.cursor = str->state.select_end = locate_coord(str, x, y);
+}
+
+// --- BGFX Rendering Details ---
 struct PosTexCoordVertex {
 	float x, y;
 	float u, v;
@@ -465,90 +1557,255 @@ struct PosTexCoordVertex {
 };
 bgfx::VertexLayout PosTexCoordVertex::s_decl;
 
-std::vector<char> ReadAssetFile(const std::string& fileName, const std::string& mode = "rb")
-{
-	SDL_IOStream* file = SDL_IOFromFile(fileName.c_str(), mode.c_str());
-	std::vector<char> data;
-
-	if (!file)
-	{
-		SDL_Log("File (%s) failed to load: %s", fileName.c_str(), SDL_GetError());
-		SDL_CloseIO(file);
-		return data;
-	}
+// --- Instanced glyph rendering ---
+// One instance per glyph (i_data0 = screen rect, i_data1 = atlas rect, i_data2 = colour), expanded
+// by vs_glyph_instanced over a single shared unit quad. No per-glyph vertices or indices, so there
+// is no 16-bit index limit either.
+struct GlyphInstance {
+	GlyphQuad quad;
+	float colour[4];
+};
+static_assert(sizeof(GlyphInstance) == 48); // instance data stride must be a multiple of 16
 
-	const int64_t size = SDL_SeekIO(file, 0, SDL_IO_SEEK_END);
-	data.resize(size);
+struct UnitQuad {
+	bgfx::VertexBufferHandle vertices = BGFX_INVALID_HANDLE;
+	bgfx::IndexBufferHandle indices = BGFX_INVALID_HANDLE;
+};
 
-	SDL_SeekIO(file, -size, SDL_IO_SEEK_END);
-	if (SDL_ReadIO(file, data.data(), size) == 0 && SDL_GetIOStatus(file) != SDL_IO_STATUS_EOF)
-	{
-		SDL_Log("File (%s) failed to read: %s", fileName.c_str(), SDL_GetError());
-		SDL_CloseIO(file);
-		return data;
-	}
+void createUnitQuad(UnitQuad& quad) {
+	static const float corners[] = { 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f };
+	static const uint16_t indices[] = { 0, 1, 2, 2, 3, 0 };
+	bgfx::VertexLayout cornerLayout;
+	cornerLayout.begin()
+		.add(bgfx::Attrib::Position, 2, bgfx::AttribType::Float)
+		.end();
+	quad.vertices = bgfx::createVertexBuffer(bgfx::makeRef(corners, sizeof(corners)), cornerLayout);
+	quad.indices = bgfx::createIndexBuffer(bgfx::makeRef(indices, sizeof(indices)));
+}
 
-	SDL_CloseIO(file);
-	return data;
+void destroyUnitQuad(UnitQuad& quad) {
+	if (bgfx::isValid(quad.vertices)) bgfx::destroy(quad.vertices);
+	if (bgfx::isValid(quad.indices)) bgfx::destroy(quad.indices);
+	quad = UnitQuad();
 }
 
-bgfx::ShaderHandle LoadShader(const std::string& shaderName)
-{
-	const std::vector<char> data = ReadAssetFile(shaderName);
+void drawTextInstanced(float offsetX, float offsetY, float zoom, text_control* str, const UnitQuad& quad, bgfx::ProgramHandle program, const GlyphUniforms& uniforms) {
+	ProfileScope scope(g_AppContext.profiler, "drawTextInstanced");
+	const TextViewport view = text_viewport(offsetX, offsetY, zoom);
 
-	if (data.empty())
-	{
-		return BGFX_INVALID_HANDLE;
-	}
+	uint32_t visible = 0;
+	for_each_visible_run(str, view, [&](int, int begin, int end) { visible += end - begin; });
+	const uint32_t maxInstances = bgfx::getAvailInstanceDataBuffer(visible, sizeof(GlyphInstance));
+	if (maxInstances == 0)
+		return;
 
-	const bgfx::Memory* const mem = bgfx::copy(data.data(), static_cast<uint32_t>(data.size()));
+	bgfx::InstanceDataBuffer instanceBuffer;
+	bgfx::allocInstanceDataBuffer(&instanceBuffer, maxInstances, sizeof(GlyphInstance));
+	auto* instances = (GlyphInstance*) instanceBuffer.data;
+	uint32_t numInstances = 0;
+
+	const float lineHeight = getLineHeight(str);
+	for_each_visible_run(str, view, [&](int line, int begin, int end) {
+		const double y = line * lineHeight;
+		for_each_glyph_span(str, begin, end, [&](const unsigned char* chars, const uint32_t* glyphs, const float* penX, size_t count) {
+			for (size_t j = 0; j < count && numInstances < maxInstances; j++) {
+				const AtlasGlyph* glyph = drawable_glyph(*str->face, chars ? chars[j] : glyphs[j]);
+				if (!glyph)
+					continue;
+
+				GlyphInstance& instance = instances[numInstances++];
+				instance.quad = getGlyphQuad(str->face->tables, glyph, penX[j], y);
+				instance.colour[0] = 0.0f;
+				instance.colour[1] = 0.0f;
+				instance.colour[2] = 0.0f;
+				instance.colour[3] = 1.0f;
+			}
+		});
+	});
+
+	if (numInstances > 0) {
+		float transform[16];
+		textTransform(transform, offsetX, offsetY, zoom);
+		bgfx::setTransform(transform);
+		bgfx::setVertexBuffer(0, quad.vertices);
+		bgfx::setIndexBuffer(quad.indices);
+		bgfx::setInstanceDataBuffer(&instanceBuffer, 0, numInstances);
+		setGlyphUniforms(uniforms, *str->face);
+		bgfx::setState(BGFX_STATE_WRITE_RGB | BGFX_STATE_WRITE_A | BGFX_STATE_MSAA | BGFX_STATE_BLEND_NORMAL);
+		bgfx::submit(0, program);
+	}
+}
 
-	const bgfx::ShaderHandle handle = bgfx::createShader(mem);
-	bgfx::setName(handle, shaderName.c_str());
+// Every shader of the editor, compiled for each backend and built into the executable (see
+// CMakeLists.txt). bgfx references the binary of the renderer in use, nothing is read or copied.
+static const bgfx::EmbeddedShader s_embeddedShaders[] = {
+	BGFX_EMBEDDED_SHADER(vs_textured_compact),
+	BGFX_EMBEDDED_SHADER(fs_msdf_compact),
+	BGFX_EMBEDDED_SHADER(vs_glyph_instanced),
+	BGFX_EMBEDDED_SHADER_END()
+};
 
-	return handle;
+bgfx::ShaderHandle LoadShader(const char* name)
+{
+	return bgfx::createEmbeddedShader(s_embeddedShaders, bgfx::getRendererType(), name);
 }
 
+// bgfx::frame, then the turn of the frame arena, which must not come any sooner: the frame just
+// submitted still reads the arena memory it was given through makeRef.
+void submit_frame() {
+	bgfx::frame();
+	g_AppContext.frame.nextFrame();
+}
 
 // --- Main Application Class ---
+enum class TextRenderMode {
+	Immediate, // re-tessellate everything into a TextBatch's transient buffer every frame
+	Retained,  // persistent TextMesh over the screen plus overscan, re-tessellated from the first edited line
+	Instanced, // one instance record per glyph over a shared unit quad (needs BGFX_CAPS_INSTANCING)
+};
+
+// One frame of the threaded mode (see TextEditorApp::threaded): built by the main thread from the
+// editor state, then only read by the render thread. The arrays are in the main thread's frame
+// arena, which does not hand their memory out again before the snapshot's queue slot is popped.
+struct FrameSnapshot {
+	std::shared_ptr<FontFace> face; // null while the font loads
+	int viewWidth = 0, viewHeight = 0;
+	float zoom = 1.0f;
+	Decorations decorations;
+	const GlyphVertex* glyphs = nullptr; // four per quad, in layout pixels
+	uint32_t glyphQuads = 0;
+	bool stop = false; // the last one: shut the renderer down, releasing face on the way
+};
+
+// Wakes the idle frame loop up (see TextEditorApp::run). Any thread.
+void wake_frame_loop() {
+	SDL_Event event = {};
+	event.type = SDL_EVENT_USER;
+	SDL_PushEvent(&event);
+}
+
 class TextEditorApp {
 private:
 	SDL_Window* window = nullptr;
 	//StbTextEditor text_editor_string;
 	text_control text_edit_state;
 
-	bgfx::ProgramHandle solid_program;
 	bgfx::ProgramHandle textured_program;
-	bgfx::UniformHandle tex_uniform;
+	bgfx::ProgramHandle instanced_program = BGFX_INVALID_HANDLE;
+	UnitQuad unit_quad;
+	GlyphUniforms glyph_uniforms;
 	bgfx::TextureHandle text_texture = BGFX_INVALID_HANDLE;
-	bgfx::VertexLayout layout;
-	std::string last_rendered_text;
+	TextMesh text_mesh;
+	TextBatch text_batch;
+	std::vector<SolidRect> decorations_under, decorations_over; // see collectDecorations
+	bgfx::IndexBufferHandle quad_indices = BGFX_INVALID_HANDLE; // decoration and snapshot draws
+	TextRenderMode text_mode = TextRenderMode::Retained;
+	bool show_stats = false; // F3
+
+	// --render-thread: render_thread initializes, feeds and shuts down bgfx, drawing the snapshots
+	// the main thread queues. The main thread only handles input and builds snapshots, so key handling
+	// no longer waits while bgfx::frame is held up by the GPU or vsync. Snapshots are drawn like
+	// TextRenderMode::Immediate (F2 does nothing) and there is no F3 overlay. The input latency the
+	// profiler measures ends when the frame is queued.
+	bool threaded = false;
+	std::thread render_thread;
+	SpscQueue<FrameSnapshot, 2> snapshots; // two slots, as the frame arena has two regions
+	std::atomic<bool> wake_on_pop { false }; // the main thread waits for a free slot
+	int rendered_width = 0, rendered_height = 0; // render thread, the backbuffer size bgfx has
+#if defined(EDITING_COUNT_ALLOCATIONS)
+	HeapCounts heap_total;      // at the end of the last frame
+	HeapCounts heap_last_frame; // from the end of the frame before to the end of the last one
+#endif
 
+	static constexpr float CARET_BLINK_SECONDS = 0.53f;
+	// A resize drag sends a burst of size changes; the backbuffer is reset once they stop for this long
+	static constexpr std::chrono::milliseconds RESIZE_SETTLE { 100 };
 	std::chrono::time_point<std::chrono::high_resolution_clock> currentTime = std::chrono::high_resolution_clock::now();
 	bool showingCursor = true;
+	bool needs_redraw = true; // set by anything that changes the frame, cleared by renderFrame
+	bool cursor_moved = false; // scroll to the cursor before the next frame
+	std::string pending_text;  // see queueText()
+	bool resize_pending = false; // the window has a new pixel size, applyResize() takes it at resize_deadline
+	std::chrono::time_point<std::chrono::high_resolution_clock> resize_deadline;
+	std::future<std::shared_ptr<FontFace>> font_loading; // until adoptLoadedFont() takes the face
+	std::string document_path; // file opened from the command line, Ctrl+S saves back to it
+	bool quit = false;
 
 	const int TEXT_BOX_X = 50;
 	const int TEXT_BOX_Y = 50;
+
+	// Scroll offset of the text in layout pixels; the text origin is drawn at
+	// (TEXT_BOX_X - scroll_x * zoom, TEXT_BOX_Y - scroll_y * zoom)
+	float scroll_x = 0.0f;
+	float scroll_y = 0.0f;
+
+	// Screen pixels per layout pixel (Ctrl+wheel, Ctrl+plus/minus, Ctrl+0). Only the draw transform
+	// changes; the layout, the atlas and the retained mesh stay as they are.
+	static constexpr float MIN_ZOOM = 0.25f, MAX_ZOOM = 8.0f, ZOOM_STEP = 1.1f;
+	float zoom = 1.0f;
 public:
 	TextEditorApp() {
 
 		// Initialize the text_control struct
-		text_edit_state.string = "";
+		text_edit_state.string.clear();
 
 		// Initialize the stb_textedit state.
-		stb_textedit_initialize_state(&text_edit_state.state, 0); // 0 = single line
+		stb_textedit_initialize_state(&text_edit_state.state, 0); // 0 = multi-line
 
 		// Optionally, move the cursor to the end of the initial text.
-		text_edit_state.state.cursor = text_edit_state.string.length();
+		text_edit_state.state.cursor = (int) text_edit_state.index.size();
 	}
 
-	bool initialize() {
+	// threadedRendering: see threaded
+	bool initialize(bool threadedRendering) {
 		if (!SDL_Init(SDL_INIT_VIDEO)) return false;
 
 		window = SDL_CreateWindow("STB TextEdit BGFX Demo (SDL3)", SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_RESIZABLE );
 		if (!window) return false;
 
-		// Initialize BGFX
+		// The backbuffer is in pixels, which for a high-density display are more than the window size
+		SDL_GetWindowSizeInPixels(window, &g_AppContext.viewWidth, &g_AppContext.viewHeight);
+
+		// Initialize vertex declarations once
+		PosTexCoordVertex::init();
+		GlyphVertex::init();
+
+		if (threadedRendering) {
+			std::promise<bool> started;
+			std::future<bool> result = started.get_future();
+			render_thread = std::thread(&TextEditorApp::renderLoop, this, std::move(started));
+			if (!result.get()) {
+				render_thread.join();
+				return false;
+			}
+			threaded = true;
+		} else if (!initRenderer()) {
+			return false;
+		}
+
+		// Initialize Text Engine
+		g_AppContext.jobs.start();
+		g_AppContext.ft = msdfgen::initializeFreetype();
+		// Finished glyphs wake the idle frame loop up, see run()
+		g_AppContext.glyphsReady = wake_frame_loop;
+		// The font loads on its own thread so that the first frame does not wait for it, however
+		// large the charset; see adoptLoadedFont()
+		font_loading = std::async(std::launch::async, [] {
+#if defined(EDITING_EMBEDDED_FONT)
+			std::shared_ptr<FontFace> face = loadFontFace("embedded", s_embeddedFont, sizeof(s_embeddedFont));
+#else
+			std::shared_ptr<FontFace> face = loadFontFace("C:/Windows/Fonts/Arial.ttf");
+#endif
+			g_AppContext.glyphsReady(); // wakes the frame loop up
+			return face;
+		});
+
+		SDL_StartTextInput(window);
+		return true;
+	}
+
+	// bgfx and every GPU resource, on the thread that is going to call bgfx::frame
+	bool initRenderer() {
 		bgfx::PlatformData platformData;
 #if defined(SDL_PLATFORM_ANDROID)
 		platformData.ndt = SDL_GetPointerProperty(SDL_GetWindowProperties(window), SDL_PROP_WINDOW_ANDROID_SURFACE_POINTER, nullptr);
@@ -576,228 +1833,843 @@ public:
 
 		bgfx::Init init;
 		init.type = bgfx::RendererType::Count; // Autoselect renderer
-		init.resolution.width = SCREEN_WIDTH;
-		init.resolution.height = SCREEN_HEIGHT;
+		init.resolution.width = (uint32_t) g_AppContext.viewWidth;
+		init.resolution.height = (uint32_t) g_AppContext.viewHeight;
 		init.resolution.reset = BGFX_RESET_VSYNC;
 		init.platformData = platformData;
+#if defined(EDITING_COUNT_ALLOCATIONS)
+		init.allocator = heapCountingAllocator();
+#endif
 		if (!bgfx::init(init)) return false;
 
 		bgfx::setViewClear(0, BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH, 0xdcdcdcU, 1.0f, 0);
-		bgfx::setViewRect(0, 0, 0, (uint16_t)SCREEN_WIDTH, (uint16_t)SCREEN_HEIGHT);
-
-		// Initialize Text Engine
-		g_AppContext.ft = msdfgen::initializeFreetype();
-		if (!loadFont("C:/Windows/Fonts/Arial.ttf")) {
-			return false;
-		}
+		rendered_width = g_AppContext.viewWidth;
+		rendered_height = g_AppContext.viewHeight;
+		setViewSize(rendered_width, rendered_height);
 
 		// Create BGFX resources
-		tex_uniform = bgfx::createUniform("s_texColor", bgfx::UniformType::Sampler);
-
-		layout
-			.begin()
-			.add(bgfx::Attrib::Position, 2, bgfx::AttribType::Float)
-			.add(bgfx::Attrib::TexCoord0, 2, bgfx::AttribType::Float)
-			.add(bgfx::Attrib::TexCoord1, 2, bgfx::AttribType::Float)
-			.add(bgfx::Attrib::Color0, 4, bgfx::AttribType::Float)
-			.end();
+		glyph_uniforms.texture = bgfx::createUniform("s_texColor", bgfx::UniformType::Sampler);
+		glyph_uniforms.pxRange = bgfx::createUniform("u_pxRange", bgfx::UniformType::Vec4);
 
-		bgfx::ShaderHandle solid_vertex = LoadShader("../shaders/vs_simple.bin");
-		bgfx::ShaderHandle solid_fragment = LoadShader("../shaders/fs_simple.bin");
-		bgfx::ShaderHandle textured_vertex = LoadShader("../shaders/vs_textured.bin");
-		bgfx::ShaderHandle textured_fragment = LoadShader("../shaders/fs_msdf.bin");
-		solid_program = bgfx::createProgram(solid_vertex, solid_fragment, true);
+		bgfx::ShaderHandle textured_vertex = LoadShader("vs_textured_compact");
+		bgfx::ShaderHandle textured_fragment = LoadShader("fs_msdf_compact");
 		textured_program = bgfx::createProgram(textured_vertex, textured_fragment, true);
+		quad_indices = createQuadIndexBuffer(TextBatch::QUADS_PER_DRAW);
 
-		SDL_StartTextInput(window);
+		if (bgfx::getCaps()->supported & BGFX_CAPS_INSTANCING) {
+			bgfx::ShaderHandle instanced_vertex = LoadShader("vs_glyph_instanced");
+			bgfx::ShaderHandle instanced_fragment = LoadShader("fs_msdf_compact");
+			instanced_program = bgfx::createProgram(instanced_vertex, instanced_fragment, true);
+			createUnitQuad(unit_quad);
+		}
 		return true;
 	}
 
 	void shutdown() {
 		SDL_StopTextInput(window);
-		if(bgfx::isValid(text_texture)) bgfx::destroy(text_texture);
-		bgfx::destroy(tex_uniform);
-		bgfx::destroy(solid_program);
-		bgfx::destroy(textured_program);
-		bgfx::shutdown();
+		if (font_loading.valid())
+			font_loading.get();
+		if (render_thread.joinable()) {
+			// The render thread takes the last reference to the face along, so that the atlas cache is
+			// saved and the atlas freed before it shuts bgfx down
+			FrameSnapshot& last = snapshots.acquireWait();
+			last = FrameSnapshot();
+			last.face = std::move(text_edit_state.face);
+			last.stop = true;
+			snapshots.publish();
+			render_thread.join();
+		} else {
+			destroyRenderResources();
+			text_edit_state.face.reset(); // the last reference saves the atlas cache and frees the atlas while bgfx is up
+			bgfx::shutdown();
+		}
+		g_AppContext.jobs.stop();
 		if (window) SDL_DestroyWindow(window);
 		SDL_Quit();
 	}
 
-	void renderFrame() {
-		// Set up orthographic projection matrix
+	void destroyRenderResources() {
+		destroyTextMesh(text_mesh);
+		destroyTextBatch(text_batch);
+		if(bgfx::isValid(text_texture)) bgfx::destroy(text_texture);
+		bgfx::destroy(quad_indices);
+		bgfx::destroy(glyph_uniforms.texture);
+		bgfx::destroy(glyph_uniforms.pxRange);
+		bgfx::destroy(textured_program);
+		if (bgfx::isValid(instanced_program)) bgfx::destroy(instanced_program);
+		destroyUnitQuad(unit_quad);
+	}
+
+	// View 0 covers the backbuffer with a pixel projection. bgfx keeps both, so this only runs when
+	// the size changes.
+	void setViewSize(int width, int height) {
 		float proj[16];
-		bx::mtxOrtho(proj, 0.0f, (float)SCREEN_WIDTH, (float)SCREEN_HEIGHT, 0.0f, 0.0f, 100.0f, 0.0f, bgfx::getCaps()->homogeneousDepth);
+		bx::mtxOrtho(proj, 0.0f, (float) width, (float) height, 0.0f, 0.0f, 100.0f, 0.0f, bgfx::getCaps()->homogeneousDepth);
+		bgfx::setViewRect(0, 0, 0, (uint16_t) width, (uint16_t) height);
 		bgfx::setViewTransform(0, NULL, proj);
+	}
+
+	// Resizes the backbuffer to the window once a burst of size changes has settled. Lines do not
+	// wrap, so nothing is laid out again; the retained mesh rebuilds its window if the larger view
+	// leaves it. Threaded, the render thread resets bgfx when a snapshot of the new size comes in.
+	void applyResize() {
+		resize_pending = false;
+		int width = 0, height = 0;
+		SDL_GetWindowSizeInPixels(window, &width, &height);
+		if (width <= 0 || height <= 0 || (width == g_AppContext.viewWidth && height == g_AppContext.viewHeight))
+			return;
+		g_AppContext.viewWidth = width;
+		g_AppContext.viewHeight = height;
+		if (!threaded) {
+			bgfx::reset((uint32_t) width, (uint32_t) height, BGFX_RESET_VSYNC);
+			setViewSize(width, height);
+		}
+		if (text_edit_state.face)
+			clampScroll();
+		needs_redraw = true;
+	}
+
+	float textOriginX() const { return TEXT_BOX_X - scroll_x * zoom; }
+	float textOriginY() const { return TEXT_BOX_Y - scroll_y * zoom; }
+
+	void setZoom(float value) {
+		zoom = std::clamp(value, MIN_ZOOM, MAX_ZOOM);
+		clampScroll();
+	}
+
+	// Keeps the scroll offset inside the document
+	void clampScroll() {
+		const float line_height = getLineHeight(&text_edit_state);
+		const float max_y = std::max(0.0f, text_edit_state.line_starts.size() * line_height - line_height);
+		scroll_x = std::max(0.0f, scroll_x);
+		scroll_y = std::clamp(scroll_y, 0.0f, max_y);
+	}
+
+	// Scrolls just enough to bring the cursor back inside the text box margins
+	void scrollToCursor() {
+		const float line_height = getLineHeight(&text_edit_state);
+		const float cursor_x = prefix_x(&text_edit_state, text_edit_state.state.cursor);
+		const float cursor_y = line_of(&text_edit_state, text_edit_state.state.cursor) * line_height;
+		const float view_w = std::max(0.0f, g_AppContext.viewWidth - 2.0f * TEXT_BOX_X) / zoom;
+		const float view_h = std::max(0.0f, g_AppContext.viewHeight - 2.0f * TEXT_BOX_Y) / zoom;
+
+		if (cursor_x < scroll_x) scroll_x = cursor_x;
+		else if (cursor_x > scroll_x + view_w) scroll_x = cursor_x - view_w;
+		if (cursor_y < scroll_y) scroll_y = cursor_y;
+		else if (cursor_y + line_height > scroll_y + view_h) scroll_y = cursor_y + line_height - view_h;
+		clampScroll();
+	}
+
+	void renderFrame() {
+		ProfileScope scope(g_AppContext.profiler, "renderFrame");
+		// Glyphs generated since the last frame are now in the atlas, the retained mesh has to pick them up
+		{
+			ProfileScope pump(g_AppContext.profiler, "GlyphAtlas::pump");
+			if (pump_font_faces())
+				text_edit_state.mesh_dirty_from = 0;
+			upload_font_faces();
+		}
+
 		bgfx::touch(0);
 
-		// Update text texture if text has changed
-		//if (last_rendered_text != text_edit_state.string) {
-		//	if (bgfx::isValid(text_texture)) bgfx::destroy(text_texture);
-		//	text_texture = createTextTexture(&text_edit_state, text_edit_state.string);
-		//	last_rendered_text = text_edit_state.string;
-		//}
+		// An empty view while the font is loading
+		if (!text_edit_state.face) {
+			submit_frame();
+			return;
+		}
 
-		// --- Draw Selection ---
-		if (text_edit_state.state.select_start != text_edit_state.state.select_end) {
-			int start_idx = std::min(text_edit_state.state.select_start, text_edit_state.state.select_end);
-			int end_idx = std::max(text_edit_state.state.select_start, text_edit_state.state.select_end);
-			int offset=0, width=0, height=0;
-			getTextSize(&text_edit_state, std::string_view(text_edit_state.string.data(), start_idx), &offset, &height);
-			getTextSize(&text_edit_state, std::string_view(text_edit_state.string.data() + start_idx, end_idx - start_idx), &width, nullptr);
-			drawSolidQuad(TEXT_BOX_X + offset, TEXT_BOX_Y, width, height, 0xffFF9664); // Blue selection
+		// --- Draw Text and Decorations ---
+		const Decorations decorations = collectDecorations();
+		const FontFace& face = *text_edit_state.face;
+		if (text_mode == TextRenderMode::Immediate) {
+			// One buffer and one draw for all of it
+			if (!text_edit_state.string.empty()) {
+				const float x = textOriginX() / zoom, y = textOriginY() / zoom;
+				addTextToBatch(text_batch, &text_edit_state, x, y, text_viewport(x, y, zoom));
+			}
+			submitTextBatch(text_batch, textured_program, glyph_uniforms, zoom, decorations, &face);
+		} else {
+			// The text is drawn from a buffer of its own, between a draw of the decorations under it and
+			// one of those over it
+			drawDecorations({ decorations.under, decorations.underCount }, quad_indices, face, textured_program, glyph_uniforms);
+			if (text_mode == TextRenderMode::Retained) {
+				updateTextMesh(text_mesh, &text_edit_state, textOriginX(), textOriginY(), zoom);
+				drawTextMesh(text_mesh, face, textOriginX(), textOriginY(), zoom, textured_program, glyph_uniforms);
+			} else {
+				drawTextInstanced(textOriginX(), textOriginY(), zoom, &text_edit_state, unit_quad, instanced_program, glyph_uniforms);
+			}
+			drawDecorations({ nullptr, 0, decorations.over, decorations.overCount }, quad_indices, face, textured_program, glyph_uniforms);
 		}
 
-		// --- Draw Text ---
-		if (!text_edit_state.string.empty()) {
-			createTextTexture(TEXT_BOX_X, TEXT_BOX_Y, &text_edit_state, text_edit_state.string, layout, textured_program, tex_uniform);
+		if (show_stats)
+			drawStatsOverlay();
+
+		submit_frame();
+	}
+
+	// The frame's decorations (see Decorations), in decorations_under and decorations_over: the
+	// current line when nothing is selected, the search matches and the selection under the text, the
+	// caret over it
+	Decorations collectDecorations() {
+		decorations_under.clear();
+		decorations_over.clear();
+		if (text_edit_state.state.select_start == text_edit_state.state.select_end)
+			decorations_under.push_back(currentLineRect());
+		addMatchRects(decorations_under);
+		addSelectionRects(decorations_under);
+		if (showingCursor)
+			decorations_over.push_back(cursorRect());
+		return { decorations_under.data(), (uint32_t) decorations_under.size(), decorations_over.data(), (uint32_t) decorations_over.size() };
+	}
+
+	// The search matches on screen as highlight rectangles, found by binary search in the match list;
+	// a match over a line break is highlighted up to the break the way the selection is
+	void addMatchRects(std::vector<SolidRect>& rects) {
+		const std::vector<size_t>& found = text_edit_state.search.getMatches();
+		if (found.empty())
+			return;
+		const float line_height = getLineHeight(&text_edit_state);
+		const int height = getFontHeight(&text_edit_state);
+		const int first_visible = std::max(0, (int) std::floor(-textOriginY() / (line_height * zoom)));
+		const int last_visible = std::min((int) text_edit_state.line_starts.size() - 1, (int) std::floor((g_AppContext.viewHeight - textOriginY()) / (line_height * zoom)));
+		if (last_visible < first_visible)
+			return;
+
+		const size_t first_byte = text_edit_state.index.byteOf(text_edit_state.string, text_edit_state.line_starts[first_visible]);
+		const size_t last_byte = text_edit_state.index.byteOf(text_edit_state.string, line_end(&text_edit_state, last_visible));
+		const auto first = std::lower_bound(found.begin(), found.end(), first_byte);
+		const auto last = std::upper_bound(first, found.end(), last_byte);
+		if (first == last)
+			return;
+
+		const size_t length = text_edit_state.search.getQuery().size();
+		for (auto it = first; it != last; ++it) {
+			const int start = (int) text_edit_state.index.codepointOf(text_edit_state.string, *it);
+			const int end = (int) text_edit_state.index.codepointOf(text_edit_state.string, *it + length);
+			const int line = line_of(&text_edit_state, start);
+			const float x0 = prefix_x(&text_edit_state, start);
+			const float x1 = line_of(&text_edit_state, end) == line
+				? prefix_x(&text_edit_state, end)
+				: prefix_x(&text_edit_state, line_end(&text_edit_state, line)) + text_edit_state.face->tables.advance[' '];
+			rects.push_back({ textOriginX() + x0 * zoom, textOriginY() + line * line_height * zoom, (x1 - x0) * zoom, height * zoom, 0xff66e0ffU }); // Yellow highlight
 		}
+	}
 
-		// --- Draw Cursor ---
-		if (showingCursor) {
-			int cursor_x = 0, cursor_h = 0;
-			getTextSize(&text_edit_state, std::string_view(text_edit_state.string.data(), text_edit_state.state.cursor), &cursor_x, &cursor_h);
-			drawSolidQuad(TEXT_BOX_X + cursor_x, TEXT_BOX_Y, 2, cursor_h, 0xff000000); // Black cursor
+	// The selection on screen, one rectangle per line; selected line breaks show as a space-wide stub
+	void addSelectionRects(std::vector<SolidRect>& rects) {
+		if (text_edit_state.state.select_start == text_edit_state.state.select_end)
+			return;
+		int start_idx = std::min(text_edit_state.state.select_start, text_edit_state.state.select_end);
+		int end_idx = std::max(text_edit_state.state.select_start, text_edit_state.state.select_end);
+		const int first_line = line_of(&text_edit_state, start_idx);
+		const int last_line = line_of(&text_edit_state, end_idx);
+		const float line_height = getLineHeight(&text_edit_state);
+		const int height = getFontHeight(&text_edit_state);
+
+		// Only the lines on screen
+		const int first_visible = std::max(first_line, (int) std::floor(-textOriginY() / (line_height * zoom)));
+		const int last_visible = std::min(last_line, (int) std::floor((g_AppContext.viewHeight - textOriginY()) / (line_height * zoom)));
+		for (int line = first_visible; line <= last_visible; ++line) {
+			const float x0 = line == first_line ? prefix_x(&text_edit_state, start_idx) : 0.0f;
+			const float x1 = line == last_line
+				? prefix_x(&text_edit_state, end_idx)
+				: prefix_x(&text_edit_state, line_end(&text_edit_state, line)) + text_edit_state.face->tables.advance[' '];
+			rects.push_back({ textOriginX() + x0 * zoom, textOriginY() + line * line_height * zoom, (x1 - x0) * zoom, height * zoom, 0xffFF9664 }); // Blue selection
 		}
+	}
 
+	// The line of the cursor, across the view
+	SolidRect currentLineRect() {
+		const float line_height = getLineHeight(&text_edit_state);
+		const int line = line_of(&text_edit_state, text_edit_state.state.cursor);
+		return { 0.0f, textOriginY() + line * line_height * zoom, (float) g_AppContext.viewWidth, line_height * zoom, 0xffe8e8e8 }; // Light grey band
+	}
 
-		bgfx::frame();
+	SolidRect cursorRect() {
+		const float cursor_x = prefix_x(&text_edit_state, text_edit_state.state.cursor);
+		const float cursor_y = line_of(&text_edit_state, text_edit_state.state.cursor) * getLineHeight(&text_edit_state);
+		const int cursor_h = getFontHeight(&text_edit_state);
+		return { textOriginX() + cursor_x * zoom, textOriginY() + cursor_y * zoom, 2, cursor_h * zoom, 0xff000000 }; // Black cursor
 	}
 
-	void drawSolidQuad(float x, float y, float w, float h, uint32_t color_abgr) {
-		bgfx::TransientVertexBuffer tvb;
-		bgfx::TransientIndexBuffer tib;
-		if (bgfx::allocTransientBuffers(&tvb, PosColorVertex::s_decl, 4, &tib, 6)) {
-			PosColorVertex* vertex = (PosColorVertex*)tvb.data;
-			vertex[0] = {x,     y,     color_abgr};
-			vertex[1] = {x + w, y,     color_abgr};
-			vertex[2] = {x + w, y + h, color_abgr};
-			vertex[3] = {x,     y + h, color_abgr};
-			uint16_t* indices = (uint16_t*)tib.data;
-			indices[0] = 0; indices[1] = 1; indices[2] = 2;
-			indices[3] = 0; indices[4] = 2; indices[5] = 3;
-			bgfx::setVertexBuffer(0, &tvb);
-			bgfx::setIndexBuffer(&tib);
-			bgfx::setState(BGFX_STATE_WRITE_RGB | BGFX_STATE_WRITE_A | BGFX_STATE_BLEND_ALPHA);
-			bgfx::submit(0, solid_program);
+	// Threaded mode: whether a snapshot can be queued now. While the render thread holds both slots
+	// it is asked to wake the frame loop up on its next pop.
+	bool snapshotSlotFree() {
+		if (!threaded || snapshots.acquire())
+			return true;
+		wake_on_pop = true;
+		return snapshots.acquire() != nullptr; // the pop may have come in between
+	}
+
+	// Threaded mode's renderFrame: the frame as a snapshot in the free queue slot (see
+	// snapshotSlotFree), without a bgfx call
+	void queueSnapshot() {
+		ProfileScope scope(g_AppContext.profiler, "queueSnapshot");
+		// The region the snapshot two frames back was built in can be reused, its slot has been popped
+		g_AppContext.frame.nextFrame();
+		{
+			ProfileScope pump(g_AppContext.profiler, "GlyphAtlas::pump");
+			pump_font_faces();
 		}
+
+		FrameSnapshot& snapshot = *snapshots.acquire();
+		snapshot = FrameSnapshot();
+		snapshot.face = text_edit_state.face;
+		snapshot.viewWidth = g_AppContext.viewWidth;
+		snapshot.viewHeight = g_AppContext.viewHeight;
+		snapshot.zoom = zoom;
+		if (snapshot.face) {
+			const Decorations decorations = collectDecorations();
+			snapshot.decorations = { copyToFrame(decorations.under, decorations.underCount), decorations.underCount,
+				copyToFrame(decorations.over, decorations.overCount), decorations.overCount };
+			if (!text_edit_state.string.empty()) {
+				const float x = textOriginX() / zoom, y = textOriginY() / zoom;
+				addTextToBatch(text_batch, &text_edit_state, x, y, text_viewport(x, y, zoom));
+				GlyphVertex* vertices = g_AppContext.frame.allocate<GlyphVertex>((size_t) text_batch.quads * 4);
+				tessellateTextBatch(text_batch, text_batch.quads, vertices);
+				snapshot.glyphs = vertices;
+				snapshot.glyphQuads = text_batch.quads;
+				clearTextBatch(text_batch);
+			}
+		}
+		snapshots.publish();
 	}
 
-	void run() {
-		// Initialize vertex declarations once
-		PosColorVertex::init();
-		PosTexCoordVertex::init();
+	// The frame arena copy a snapshot keeps of rects
+	static const SolidRect* copyToFrame(const SolidRect* rects, uint32_t count) {
+		SolidRect* copy = g_AppContext.frame.allocate<SolidRect>(count);
+		std::copy(rects, rects + count, copy);
+		return copy;
+	}
+
+	// The render thread: bgfx from initRenderer to bgfx::shutdown, one frame per snapshot
+	void renderLoop(std::promise<bool> started) {
+		const bool ok = initRenderer();
+		started.set_value(ok);
+		if (!ok)
+			return;
+		for (;;) {
+			FrameSnapshot& snapshot = snapshots.front();
+			if (snapshot.stop) {
+				std::shared_ptr<FontFace> face = std::move(snapshot.face);
+				snapshots.pop();
+				destroyRenderResources();
+				face.reset(); // the last reference saves the atlas cache and frees the atlas while bgfx is up
+				bgfx::shutdown();
+				return;
+			}
+			drawSnapshot(snapshot);
+			snapshot.face.reset(); // the main thread may hold the only other reference
+			snapshots.pop();
+			if (wake_on_pop.exchange(false))
+				wake_frame_loop();
+			bgfx::frame();
+		}
+	}
+
+	// Render thread: submits one snapshot, decorations and glyphs with one draw. The glyph vertices are
+	// copied into a transient buffer, as the snapshot's memory is only the render thread's until the pop.
+	void drawSnapshot(const FrameSnapshot& snapshot) {
+		if (snapshot.viewWidth != rendered_width || snapshot.viewHeight != rendered_height) {
+			rendered_width = snapshot.viewWidth;
+			rendered_height = snapshot.viewHeight;
+			bgfx::reset((uint32_t) rendered_width, (uint32_t) rendered_height, BGFX_RESET_VSYNC);
+			setViewSize(rendered_width, rendered_height);
+		}
+		bgfx::touch(0);
+
+		// An empty view while the font is loading
+		if (!snapshot.face)
+			return;
+		snapshot.face->atlas.upload();
+
+		drawDecoratedQuads(snapshot.decorations, snapshot.glyphQuads, [&](GlyphVertex* vertices, uint32_t quads) {
+			std::memcpy(vertices, snapshot.glyphs, (size_t) quads * 4 * sizeof(GlyphVertex));
+		}, quad_indices, *snapshot.face, snapshot.zoom, textured_program, glyph_uniforms);
+	}
+
+	// bgfx debug text with the renderer's numbers for the previous frame, the input latency and the
+	// zone totals of the last frame
+	void drawStatsOverlay() {
+		const bgfx::Stats* stats = bgfx::getStats();
+		const Profiler& profiler = g_AppContext.profiler;
+		const double cpu_ms = stats->cpuTimerFreq ? 1000.0 * stats->cpuTimeFrame / stats->cpuTimerFreq : 0.0;
+		const double gpu_ms = stats->gpuTimerFreq ? 1000.0 * (stats->gpuTimeEnd - stats->gpuTimeBegin) / stats->gpuTimerFreq : 0.0;
+		const Profiler::Latency& latency = profiler.getInputLatency();
+
+		uint16_t row = 0;
+		bgfx::dbgTextClear();
+		bgfx::dbgTextPrintf(0, row++, 0x0f, "CPU %6.2f ms  GPU %6.2f ms  draws %u", cpu_ms, gpu_ms, stats->numDraw);
+		bgfx::dbgTextPrintf(0, row++, 0x0f, "transient VB %d B  IB %d B", stats->transientVbUsed, stats->transientIbUsed);
+		bgfx::dbgTextPrintf(0, row++, 0x0f, "input->frame %6.2f ms (avg %6.2f, max %6.2f)",
+			latency.last / 1e6, latency.average / 1e6, latency.max / 1e6);
+		const ShapedRunCache& runs = text_edit_state.face->runs;
+		bgfx::dbgTextPrintf(0, row++, 0x0f, "shaped runs %zu  hits %llu  misses %llu", runs.size(),
+			(unsigned long long) runs.getHits(), (unsigned long long) runs.getMisses());
+		const TextSearch& search = text_edit_state.search;
+		if (search.active())
+			bgfx::dbgTextPrintf(0, row++, 0x0f, "search %zu matches%s", search.getMatches().size(), search.isComplete() ? "" : " (scanning)");
+#if defined(EDITING_COUNT_ALLOCATIONS)
+		bgfx::dbgTextPrintf(0, row++, 0x0f, "heap allocs/frame  new %llu  SDL %llu  bgfx %llu  frame arena %zu KB",
+			(unsigned long long) heap_last_frame.cpp, (unsigned long long) heap_last_frame.sdl,
+			(unsigned long long) heap_last_frame.bgfx, g_AppContext.frame.capacity() >> 10);
+#else
+		bgfx::dbgTextPrintf(0, row++, 0x0f, "frame arena %zu KB", g_AppContext.frame.capacity() >> 10);
+#endif
+		for (const Profiler::Zone& zone : profiler.getZones())
+			bgfx::dbgTextPrintf(0, row++, 0x07, "%-20s %8.3f ms %5u calls", zone.name, zone.lastTime / 1e6, zone.lastCalls);
+		if (profiler.isCapturing())
+			bgfx::dbgTextPrintf(0, row++, 0x0c, "capturing trace (F4 to save)");
+	}
+
+	// F4 starts a trace capture and, pressed again, writes it as Chrome trace JSON to the pref path
+	void toggleTraceCapture() {
+		Profiler& profiler = g_AppContext.profiler;
+		if (!profiler.isCapturing()) {
+			profiler.startCapture();
+			return;
+		}
+		profiler.stopCapture();
+
+		char* pref = SDL_GetPrefPath("stb_textedit", "editing_text");
+		char name[64];
+		SDL_snprintf(name, sizeof(name), "trace-%llu.json", (unsigned long long) SDL_GetTicks());
+		const std::string path = std::string(pref ? pref : "") + name;
+		SDL_free(pref);
+		if (profiler.writeChromeTrace(path.c_str()))
+			SDL_Log("Trace written to %s", path.c_str());
+		else
+			SDL_Log("Failed to write %s", path.c_str());
+	}
+
+	// Whether an event can change what is on screen. Plain mouse moves and key releases do not.
+	static bool changesFrame(const SDL_Event& e) {
+		switch (e.type) {
+			case SDL_EVENT_KEY_DOWN:
+			case SDL_EVENT_TEXT_INPUT:
+			case SDL_EVENT_MOUSE_BUTTON_DOWN:
+			case SDL_EVENT_MOUSE_WHEEL:
+			case SDL_EVENT_USER: // glyphs or the font became ready, or the render thread freed a snapshot slot
+				return true;
+			case SDL_EVENT_MOUSE_MOTION:
+				return (e.motion.state & SDL_BUTTON_LMASK) != 0;
+			default:
+				return e.type >= SDL_EVENT_WINDOW_FIRST && e.type <= SDL_EVENT_WINDOW_LAST;
+		}
+	}
+
+	// Applies one input or window event to the editor state
+	void handleEvent(const SDL_Event& e) {
+		if (changesFrame(e)) {
+			needs_redraw = true;
+			// Key-to-photon latency is measured for user input, not glyph or window notifications
+			if (e.type >= SDL_EVENT_KEY_DOWN && e.type < SDL_EVENT_USER)
+				g_AppContext.profiler.markInput(e.common.timestamp);
+		}
+
+		// Nothing can be laid out before the font is there; typed text waits in pending_text
+		if (!text_edit_state.face && e.type != SDL_EVENT_QUIT && e.type != SDL_EVENT_TEXT_INPUT && e.type != SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED)
+			return;
+
+		if (e.type == SDL_EVENT_QUIT) {
+			quit = true;
+		} else if (e.type == SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED) {
+			resize_pending = true;
+			resize_deadline = std::chrono::high_resolution_clock::now() + RESIZE_SETTLE;
+		} else if (e.type == SDL_EVENT_KEY_DOWN) {
+			int key = 0;
+			switch (e.key.key) {
+				case SDLK_LEFT:      key = STB_TEXTEDIT_K_LEFT;     break;
+				case SDLK_RIGHT:     key = STB_TEXTEDIT_K_RIGHT;    break;
+				case SDLK_UP:        key = STB_TEXTEDIT_K_UP;       break;
+				case SDLK_DOWN:      key = STB_TEXTEDIT_K_DOWN;     break;
+				case SDLK_HOME:      key = STB_TEXTEDIT_K_LINESTART;break;
+				case SDLK_END:       key = STB_TEXTEDIT_K_LINEEND;  break;
+				case SDLK_BACKSPACE: key = STB_TEXTEDIT_K_BACKSPACE;break;
+				case SDLK_DELETE:    key = STB_TEXTEDIT_K_DELETE;   break;
+				case SDLK_INSERT:    key = STB_TEXTEDIT_K_INSERT;   break;
+				case SDLK_PAGEUP:    key = STB_TEXTEDIT_K_LINESTART;break;
+				case SDLK_PAGEDOWN:  key = STB_TEXTEDIT_K_LINEEND;  break;
+				case SDLK_RETURN:    key = '\n';                    break;
+			}
+
+			// A line break is just more text for the batch, in overwrite mode too: stb would replace
+			// the next character with it, and drops it once Shift or Ctrl is OR'ed into the key. The
+			// overwrite keys typed after it flush the batch first (text_type), so it stays in order.
+			// Editing keys and shortcuts have to see the text typed before them; the key presses
+			// that come with typed characters do not.
+			if (key == '\n') {
+				queueText("\n", 1);
+				key = 0;
+			} else if (key || (SDL_GetModState() & SDL_KMOD_CTRL)) {
+				flushText();
+			}
+
+			if (e.key.key == SDLK_F3 && !threaded) {
+				show_stats = !show_stats;
+				bgfx::setDebug(show_stats ? BGFX_DEBUG_TEXT : BGFX_DEBUG_NONE);
+			}
+
+			if (e.key.key == SDLK_F4) {
+				toggleTraceCapture();
+			}
+
+			if (e.key.key == SDLK_F2) {
+				// Cycle Retained -> Instanced -> Immediate, skipping Instanced without GPU support
+				switch (text_mode) {
+					case TextRenderMode::Retained:  text_mode = bgfx::isValid(instanced_program) ? TextRenderMode::Instanced : TextRenderMode::Immediate; break;
+					case TextRenderMode::Instanced: text_mode = TextRenderMode::Immediate; break;
+					case TextRenderMode::Immediate: text_mode = TextRenderMode::Retained;  break;
+				}
+			}
+
+			if (e.key.key == SDLK_C && SDL_GetModState() & SDL_KMOD_CTRL && text_edit_state.state.select_start - text_edit_state.state.select_end != 0) {
+				copySelection();
+
+				showingCursor = true;
+				currentTime = std::chrono::high_resolution_clock::now();
+			}
+
+			if (e.key.key == SDLK_X && SDL_GetModState() & SDL_KMOD_CTRL && text_edit_state.state.select_start - text_edit_state.state.select_end != 0) {
+				copySelection();
+				text_seal_undo(&text_edit_state);
+				stb_textedit_cut(&text_edit_state, &text_edit_state.state);
+				text_seal_undo(&text_edit_state);
+				cursor_moved = true;
+
+				showingCursor = true;
+				currentTime = std::chrono::high_resolution_clock::now();
+			}
+
+			if (e.key.key == SDLK_V && SDL_GetModState() & SDL_KMOD_CTRL) {
+				pasteClipboard();
+
+				showingCursor = true;
+				currentTime = std::chrono::high_resolution_clock::now();
+			}
+
+			if ((e.key.key == SDLK_Z || e.key.key == SDLK_Y) && SDL_GetModState() & SDL_KMOD_CTRL) {
+				text_undo(&text_edit_state, e.key.key == SDLK_Y);
+				cursor_moved = true;
+
+				showingCursor = true;
+				currentTime = std::chrono::high_resolution_clock::now();
+			}
+
+			if (SDL_GetModState() & SDL_KMOD_CTRL) {
+				if (e.key.key == SDLK_EQUALS || e.key.key == SDLK_KP_PLUS) setZoom(zoom * ZOOM_STEP);
+				if (e.key.key == SDLK_MINUS || e.key.key == SDLK_KP_MINUS) setZoom(zoom / ZOOM_STEP);
+				if (e.key.key == SDLK_0 || e.key.key == SDLK_KP_0) setZoom(1.0f);
+			}
+
+			if (e.key.key == SDLK_S && SDL_GetModState() & SDL_KMOD_CTRL) {
+				saveDocument();
+			}
+
+			if (e.key.key == SDLK_F && SDL_GetModState() & SDL_KMOD_CTRL) {
+				findSelection();
+			}
 
-		bool quit = false;
+			if (e.key.key == SDLK_G && SDL_GetModState() & SDL_KMOD_CTRL && text_find_next(&text_edit_state, SDL_GetModState() & SDL_KMOD_SHIFT)) {
+				text_seal_undo(&text_edit_state);
+				cursor_moved = true;
+
+				showingCursor = true;
+				currentTime = std::chrono::high_resolution_clock::now();
+			}
+
+			if (e.key.key == SDLK_ESCAPE) {
+				text_find(&text_edit_state, "", 0);
+			}
+
+			if (e.key.key == SDLK_A && SDL_GetModState() & SDL_KMOD_CTRL) {
+				text_edit_state.state.select_start = 0;
+				text_edit_state.state.select_end = (int) text_edit_state.index.size();
+
+				showingCursor = true;
+				currentTime = std::chrono::high_resolution_clock::now();
+			}
+
+			if (key) {
+				// Runs of backspace/delete extend the current undo step, anything else ends it
+				if (key != (int) STB_TEXTEDIT_K_BACKSPACE && key != (int) STB_TEXTEDIT_K_DELETE)
+					text_seal_undo(&text_edit_state);
+				if (SDL_GetModState() & SDL_KMOD_SHIFT) key |= STB_TEXTEDIT_K_SHIFT;
+				if (SDL_GetModState() & SDL_KMOD_CTRL)  key |= STB_TEXTEDIT_K_CONTROL;
+				ProfileScope scope(g_AppContext.profiler, "stb_textedit_key");
+				stb_textedit_key(&text_edit_state, &text_edit_state.state, key);
+				cursor_moved = true;
+
+				showingCursor = true;
+				currentTime = std::chrono::high_resolution_clock::now();
+			}
+
+		} else if (e.type == SDL_EVENT_MOUSE_BUTTON_DOWN && e.button.button == SDL_BUTTON_LEFT) {
+			flushText();
+			text_seal_undo(&text_edit_state);
+			text_click(&text_edit_state, (e.button.x - textOriginX()) / zoom, (e.button.y - textOriginY()) / zoom);
+
+			showingCursor = true;
+			currentTime = std::chrono::high_resolution_clock::now();
+		} else if (e.type == SDL_EVENT_MOUSE_MOTION && (e.motion.state & SDL_BUTTON_LMASK)) {
+			flushText();
+			text_drag(&text_edit_state, (e.motion.x - textOriginX()) / zoom, (e.motion.y - textOriginY()) / zoom);
+
+			showingCursor = true;
+			currentTime = std::chrono::high_resolution_clock::now();
+		} else if (e.type == SDL_EVENT_MOUSE_WHEEL && SDL_GetModState() & SDL_KMOD_CTRL) {
+			const float direction = e.wheel.direction == SDL_MOUSEWHEEL_FLIPPED ? -1.0f : 1.0f;
+			setZoom(zoom * std::pow(ZOOM_STEP, direction * e.wheel.y));
+		} else if (e.type == SDL_EVENT_MOUSE_WHEEL) {
+			// Three lines per notch, like most editors
+			const float notch = 3.0f * getLineHeight(&text_edit_state);
+			const float direction = e.wheel.direction == SDL_MOUSEWHEEL_FLIPPED ? -1.0f : 1.0f;
+			scroll_x += direction * e.wheel.x * notch;
+			scroll_y -= direction * e.wheel.y * notch;
+			clampScroll();
+		} else if (e.type == SDL_EVENT_TEXT_INPUT) {
+			const char* text = e.text.text;
+			const size_t length = std::strlen(text);
+
+			if (text_type(&text_edit_state, pending_text, text, length))
+				cursor_moved = true;
+
+			showingCursor = true;
+			currentTime = std::chrono::high_resolution_clock::now();
+		}
+	}
+
+	// Hands the clipboard buffer straight to the text storage: one strlen and one UTF-8 check, no
+	// event round trip and, with the piece table, no copy of the text.
+	void pasteClipboard() {
+		char* text = SDL_GetClipboardText();
+		if (!text)
+			return;
+		size_t length = std::strlen(text);
+		OwnedText owned(text, SDL_free);
+		if (OwnedText converted = valid_utf8(text, length))
+			owned = std::move(converted);
+		text_seal_undo(&text_edit_state);
+		text_paste(&text_edit_state, std::move(owned), length);
+		text_seal_undo(&text_edit_state);
+		cursor_moved = true;
+	}
+
+	// Maps the file and hands the mapping to the storage as its original text, so the only O(n)
+	// work left is checking the UTF-8 and building the indices. A file that is not UTF-8 is read as
+	// Latin-1 into memory instead, and saved as UTF-8. stb_textedit positions are ints, which caps
+	// documents at 2 GB.
+	bool openDocument(const std::string& path) {
+		auto file = std::make_shared<MappedFile>();
+		if (!file->open(path)) {
+			SDL_Log("Failed to open %s", path.c_str());
+			return false;
+		}
+		if (file->size() > (size_t) INT_MAX) {
+			SDL_Log("%s is too large to edit", path.c_str());
+			return false;
+		}
+
+		pending_text.clear();
+		size_t size = file->size();
+		if (OwnedText converted = valid_utf8(file->data(), size)) {
+			text_edit_state.string.clear();
+			text_edit_state.string.adopt(0, std::move(converted), size);
+		} else {
+			text_edit_state.string.assignShared(file->data(), size, file);
+		}
+		rebuild_text_index(&text_edit_state);
+		stb_textedit_initialize_state(&text_edit_state.state, 0); // undo records refer to the old text
+#if !defined(TEXT_STORAGE_GAP_BUFFER)
+		text_edit_state.undo.clear();
+#endif
+		document_path = path;
+		scroll_x = scroll_y = 0.0f;
+		needs_redraw = true;
+
+		SDL_SetWindowTitle(window, path.c_str());
+		return true;
+	}
+
+	void saveDocument() {
+		if (document_path.empty())
+			return;
+#if defined(_WIN32)
+		// Windows refuses to replace a file that is still mapped
+		text_edit_state.string.unshare();
+#endif
+		if (!writeTextFile(text_edit_state.string, document_path))
+			SDL_Log("Failed to save %s", document_path.c_str());
+	}
+
+	// Ctrl+F: searches for the selected text, which has to be on one line; without a selection the
+	// search ends. Ctrl+G and Ctrl+Shift+G go to the next and previous match, Escape ends it too.
+	void findSelection() {
+		const int min = std::min(text_edit_state.state.select_start, text_edit_state.state.select_end);
+		const int max = std::max(text_edit_state.state.select_start, text_edit_state.state.select_end);
+		if (min == max || line_of(&text_edit_state, min) != line_of(&text_edit_state, max)) {
+			text_find(&text_edit_state, "", 0);
+			return;
+		}
+		const size_t first = text_edit_state.index.byteOf(text_edit_state.string, min);
+		std::string query(text_edit_state.index.byteOf(text_edit_state.string, max) - first, '\0');
+		text_edit_state.string.copyTo(first, query.size(), query.data());
+		text_find(&text_edit_state, query.data(), query.size());
+	}
+
+	// Copies the selection once, straight from the storage into a buffer SDL takes over through
+	// SDL_SetClipboardData, instead of into a temporary string that SDL_SetClipboardText copies again.
+	// The text follows its header in the same allocation.
+	void copySelection() {
+		const int min = std::min(text_edit_state.state.select_start, text_edit_state.state.select_end);
+		const int max = std::max(text_edit_state.state.select_start, text_edit_state.state.select_end);
+
+		struct ClipboardText {
+			char* data;
+			size_t size;
+		};
+		const size_t first = text_edit_state.index.byteOf(text_edit_state.string, min);
+		const size_t size = text_edit_state.index.byteOf(text_edit_state.string, max) - first;
+		auto* clip = (ClipboardText*) SDL_malloc(sizeof(ClipboardText) + size + 1);
+		clip->size = size;
+		clip->data = (char*) (clip + 1);
+		text_edit_state.string.copyTo(first, clip->size, clip->data);
+		clip->data[clip->size] = '\0';
+
+		static const char* mime_types[] = { "text/plain;charset=utf-8", "text/plain", "UTF8_STRING", "TEXT" };
+		SDL_SetClipboardData(
+			[](void* userdata, const char*, size_t* size) -> const void* {
+				const ClipboardText* clip = (const ClipboardText*) userdata;
+				*size = clip->size;
+				return clip->data;
+			},
+			[](void* userdata) { SDL_free(userdata); },
+			clip, mime_types, SDL_arraysize(mime_types));
+	}
+
+	// Typed text is collected while the event queue drains and inserted as one edit by flushText(),
+	// see text_type()
+	void queueText(const char* text, int length) {
+		pending_text.append(text, length);
+	}
+
+	void flushText() {
+		if (text_flush_typed(&text_edit_state, pending_text))
+			cursor_moved = true;
+	}
+
+	// Takes the face over once the loading thread has it; quits if the font could not be loaded.
+	void adoptLoadedFont() {
+		if (!font_loading.valid() || font_loading.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return;
+		std::shared_ptr<FontFace> face = font_loading.get();
+		if (!face) {
+			SDL_Log("The font could not be loaded");
+			quit = true;
+			return;
+		}
+		registerFontFace(face);
+		text_edit_state.face = std::move(face);
+		rebuild_text_index(&text_edit_state);
+		needs_redraw = true;
+		cursor_moved = true;
+	}
+
+	void run() {
 		SDL_Event e;
 		while (!quit) {
-			if (std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - currentTime).count() >= 0.53) {
-				currentTime = std::chrono::high_resolution_clock::now();
+			// Sleep until input arrives, the caret has to blink or a resize has settled; nothing is drawn
+			// while idle, or while the render thread is two snapshots behind
+			const auto blink = currentTime + std::chrono::duration<float>(CARET_BLINK_SECONDS);
+			const auto now = std::chrono::high_resolution_clock::now();
+			if (resize_pending && now >= resize_deadline)
+				applyResize();
+			if (now >= blink) {
+				currentTime = now;
 				showingCursor = !showingCursor;
+				needs_redraw = true;
+			} else if (!needs_redraw || !snapshotSlotFree()) {
+				auto wait = std::chrono::ceil<std::chrono::milliseconds>(blink - now);
+				if (resize_pending)
+					wait = std::min(wait, std::chrono::ceil<std::chrono::milliseconds>(resize_deadline - now));
+				const auto timeout = wait.count();
+				if (SDL_WaitEventTimeout(&e, (Sint32) timeout))
+					handleEvent(e);
 			}
 
-			while (SDL_PollEvent(&e) != 0) {
-				if (e.type == SDL_EVENT_QUIT) {
-					quit = true;
-				} else if (e.type == SDL_EVENT_KEY_DOWN) {
-					int key = 0;
-					switch (e.key.key) {
-						case SDLK_LEFT:      key = STB_TEXTEDIT_K_LEFT;     break;
-						case SDLK_RIGHT:     key = STB_TEXTEDIT_K_RIGHT;    break;
-						case SDLK_UP:        key = STB_TEXTEDIT_K_UP;       break;
-						case SDLK_DOWN:      key = STB_TEXTEDIT_K_DOWN;     break;
-						case SDLK_HOME:      key = STB_TEXTEDIT_K_LINESTART;break;
-						case SDLK_END:       key = STB_TEXTEDIT_K_LINEEND;  break;
-						case SDLK_BACKSPACE: key = STB_TEXTEDIT_K_BACKSPACE;break;
-						case SDLK_DELETE:    key = STB_TEXTEDIT_K_DELETE;   break;
-						case SDLK_INSERT:    key = STB_TEXTEDIT_K_INSERT;   break;
-						case SDLK_PAGEUP:    key = STB_TEXTEDIT_K_LINESTART;break;
-						case SDLK_PAGEDOWN:  key = STB_TEXTEDIT_K_LINEEND;  break;
-					}
-
-					if (e.key.key == SDLK_C && SDL_GetModState() & SDL_KMOD_CTRL && text_edit_state.state.select_start - text_edit_state.state.select_end != 0) {
-						int min = std::min(text_edit_state.state.select_start, text_edit_state.state.select_end);
-						int max = std::max(text_edit_state.state.select_start, text_edit_state.state.select_end);
-						std::string copy(text_edit_state.string.data() + min, max - min);
-
-						SDL_SetClipboardText(copy.c_str());
-
-						showingCursor = true;
-						currentTime = std::chrono::high_resolution_clock::now();
-					}
-
-					if (e.key.key == SDLK_X && SDL_GetModState() & SDL_KMOD_CTRL && text_edit_state.state.select_start - text_edit_state.state.select_end != 0) {
-						int min = std::min(text_edit_state.state.select_start, text_edit_state.state.select_end);
-						int max = std::max(text_edit_state.state.select_start, text_edit_state.state.select_end);
-						std::string cut(text_edit_state.string.data() + min, max - min);
-
-						SDL_SetClipboardText(cut.c_str());
-						stb_textedit_cut(&text_edit_state, &text_edit_state.state);
-
-						showingCursor = true;
-						currentTime = std::chrono::high_resolution_clock::now();
-					}
-
-					if (e.key.key == SDLK_V && SDL_GetModState() & SDL_KMOD_CTRL) {
-						SDL_Event event;
-
-						event.type = SDL_EVENT_TEXT_INPUT;
-						event.text.text = SDL_GetClipboardText();
-						event.text.reserved = 8372194;
-
-						SDL_PushEvent(&event);
-
-						showingCursor = true;
-						currentTime = std::chrono::high_resolution_clock::now();
-					}
-
-					if (e.key.key == SDLK_A && SDL_GetModState() & SDL_KMOD_CTRL) {
-						text_edit_state.state.select_start = 0;
-						text_edit_state.state.select_end = text_edit_state.string.length();
-
-						showingCursor = true;
-						currentTime = std::chrono::high_resolution_clock::now();
-					}
-
-					if (key) {
-						if (SDL_GetModState() & SDL_KMOD_SHIFT) key |= STB_TEXTEDIT_K_SHIFT;
-						if (SDL_GetModState() & SDL_KMOD_CTRL)  key |= STB_TEXTEDIT_K_CONTROL;
-						stb_textedit_key(&text_edit_state, &text_edit_state.state, key);
-
-						showingCursor = true;
-						currentTime = std::chrono::high_resolution_clock::now();
-					}
-
-				} else if (e.type == SDL_EVENT_TEXT_INPUT) {
-					int length = std::strlen(e.text.text);
-
-					if (length > 1) {
-						stb_textedit_paste(&text_edit_state, &text_edit_state.state, e.text.text, length);
-
-						if (e.text.reserved == 8372194) {
-							SDL_free((void*) e.text.text);
-						}
-					}
-					else {
-						stb_textedit_key(&text_edit_state, &text_edit_state.state, e.text.text[0]);
-					}
-
-					showingCursor = true;
-					currentTime = std::chrono::high_resolution_clock::now();
-				}
+			while (SDL_PollEvent(&e) != 0)
+				handleEvent(e);
+			adoptLoadedFont();
+
+			// Once per frame, after the whole queue: one insert for the batched text, one scroll
+			flushText();
+			if (cursor_moved) {
+				scrollToCursor();
+				cursor_moved = false;
+			}
+
+			// A search scans one slice per frame, so input keeps being handled while it goes through a large
+			// document; every slice shows the matches found so far
+			if (!text_edit_state.search.isComplete()) {
+				ProfileScope scope(g_AppContext.profiler, "text_search_step");
+				text_search_step(&text_edit_state);
+				needs_redraw = true;
 			}
-			renderFrame();
+
+			if (needs_redraw && !quit && snapshotSlotFree()) {
+				if (threaded)
+					queueSnapshot();
+				else
+					renderFrame();
+				g_AppContext.profiler.endFrame();
+				needs_redraw = false;
+#if defined(EDITING_COUNT_ALLOCATIONS)
+				const HeapCounts total = heapCounts();
+				heap_last_frame = total - heap_total;
+				heap_total = total;
+#endif
+			}
+			if (text_edit_state.face)
+				trimLineWidths();
 		}
 	}
+
+	// Between frames, nothing holds line offsets: the lines out of sight give theirs up once many are
+	// shaped (see LineWidths::trim)
+	void trimLineWidths() {
+		const float line_height = getLineHeight(&text_edit_state) * zoom;
+		const int first = std::max(0, (int) std::floor(-textOriginY() / line_height));
+		const int last = (int) std::floor((g_AppContext.viewHeight - textOriginY()) / line_height);
+		text_edit_state.widths.trim(first, std::max(first, last));
+	}
 };
 
 
+#if defined(EDITING_TEXT_BENCH)
+#include "text_bench.h"
+#else
 int main(int argc, char* args[]) {
+#if defined(EDITING_COUNT_ALLOCATIONS)
+	countSDLAllocations();
+#endif
+	// editing_text [--render-thread] [document]
+	bool threaded = false;
+	const char* document = nullptr;
+	for (int i = 1; i < argc; ++i) {
+		if (SDL_strcmp(args[i], "--render-thread") == 0)
+			threaded = true;
+		else
+			document = args[i];
+	}
+
 	TextEditorApp app;
-	if (app.initialize()) {
+	if (app.initialize(threaded)) {
+		if (document)
+			app.openDocument(document);
 		app.run();
 	}
 	app.shutdown();
 	msdfgen::deinitializeFreetype(g_AppContext.ft);
 	return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,99 @@
+// pool_allocator.h
+// Recycled fixed-size blocks for memory that comes and goes with editing: the undo steps and pieces
+// (text_undo.h) and the pen offsets of shaped-run cache entries (shaped_run_cache.h).
+//
+// BlockPool rounds a request up to a power of two from 16 B to 4 KB and hands out blocks of that
+// size from one free list per size, carved from 64 KB slabs. Freed blocks go back on their list and
+// slabs are kept for the life of the process, so memory that is released and taken again (evicted
+// cache entries, dropped redo steps, a cleared history) only comes from the global heap once.
+// Larger requests go straight to operator new. PoolAllocator puts standard containers on top of
+// the process-wide pool, blockPool(). Main thread only.
+
+#pragma once
+
+#include <vector>
+#include <new>
+#include <cstddef>
+
+class BlockPool {
+public:
+	static constexpr size_t MIN_BLOCK = 16; // also the alignment of every block
+	static constexpr size_t MAX_BLOCK = 4096;
+
+	void* allocate(size_t bytes) {
+		if (bytes > MAX_BLOCK)
+			return ::operator new(bytes);
+		const unsigned size = sizeClass(bytes);
+		if (!free[size])
+			refill(size);
+		Block* block = free[size];
+		free[size] = block->next;
+		return block;
+	}
+
+	void deallocate(void* p, size_t bytes) {
+		if (!p)
+			return;
+		if (bytes > MAX_BLOCK) {
+			::operator delete(p);
+			return;
+		}
+		const unsigned size = sizeClass(bytes);
+		Block* block = static_cast<Block*>(p);
+		block->next = free[size];
+		free[size] = block;
+	}
+
+private:
+	static constexpr size_t SLAB = 64 << 10;
+	static constexpr unsigned SIZES = 9; // MIN_BLOCK << 0 ... MIN_BLOCK << 8 == MAX_BLOCK
+
+	struct Block {
+		Block* next;
+	};
+
+	static unsigned sizeClass(size_t bytes) {
+		unsigned size = 0;
+		while ((MIN_BLOCK << size) < bytes)
+			++size;
+		return size;
+	}
+
+	// Splits a new slab into blocks of one size
+	void refill(unsigned size) {
+		char* slab = static_cast<char*>(::operator new(SLAB));
+		slabs.push_back(slab);
+		const size_t blockSize = MIN_BLOCK << size;
+		for (size_t offset = SLAB; offset >= blockSize; ) {
+			offset -= blockSize;
+			Block* block = reinterpret_cast<Block*>(slab + offset);
+			block->next = free[size];
+			free[size] = block;
+		}
+	}
+
+	Block* free[SIZES] = {};
+	std::vector<char*> slabs;
+};
+
+// Never destroyed, so containers in static storage can still give their blocks back at exit
+inline BlockPool& blockPool() {
+	static BlockPool* pool = new BlockPool();
+	return *pool;
+}
+
+template <typename T>
+struct PoolAllocator {
+	static_assert(alignof(T) <= BlockPool::MIN_BLOCK, "BlockPool blocks are 16-byte aligned");
+	using value_type = T;
+
+	PoolAllocator() = default;
+	template <typename U>
+	PoolAllocator(const PoolAllocator<U>&) {}
+
+	T* allocate(size_t count) { return static_cast<T*>(blockPool().allocate(count * sizeof(T))); }
+	void deallocate(T* p, size_t count) { blockPool().deallocate(p, count * sizeof(T)); }
+
+	template <typename U>
+	bool operator==(const PoolAllocator<U>&) const { return true; }
+};
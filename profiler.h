@@ -0,0 +1,151 @@
+// profiler.h
+// Lightweight instrumentation for the editor's hot paths.
+//
+//   ProfileScope  - RAII timer around a block. Adds its time to the per-frame totals shown by the
+//                   overlay and, while a capture runs, appends a complete event to the trace.
+//   Profiler      - zone totals of the last frame, key-to-photon latency (oldest unpresented
+//                   input event timestamp up to the return of bgfx::frame) and a Chrome trace
+//                   capture that writeChromeTrace() saves for chrome://tracing or Perfetto.
+//
+// Times come from SDL_GetTicksNS, the clock SDL stamps events with. Main thread only.
+
+#pragma once
+
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+
+#include <SDL3/SDL.h>
+
+class Profiler {
+public:
+	struct Zone {
+		const char* name; // string literal, compared by address
+		uint64_t frameTime = 0;
+		uint32_t frameCalls = 0;
+		uint64_t lastTime = 0; // totals of the last finished frame
+		uint32_t lastCalls = 0;
+	};
+
+	struct Latency {
+		uint64_t last = 0; // ns
+		uint64_t max = 0;
+		double average = 0.0; // exponential moving average
+	};
+
+	void addZone(const char* name, uint64_t start, uint64_t duration) {
+		Zone& zone = find(name);
+		zone.frameTime += duration;
+		++zone.frameCalls;
+		if (capturing)
+			record(TraceEvent { name, start, duration, Phase::Complete });
+	}
+
+	// An input event that will change the frame; only the oldest one per frame counts.
+	void markInput(uint64_t timestamp) {
+		if (pendingInput == 0 || timestamp < pendingInput)
+			pendingInput = timestamp;
+	}
+
+	// After bgfx::frame: closes the input latency and rolls the zone totals over.
+	void endFrame() {
+		const uint64_t now = SDL_GetTicksNS();
+		if (pendingInput != 0) {
+			const uint64_t latency = now > pendingInput ? now - pendingInput : 0;
+			inputLatency.last = latency;
+			inputLatency.max = std::max(inputLatency.max, latency);
+			inputLatency.average = inputLatency.average == 0.0 ? (double) latency : inputLatency.average * 0.9 + latency * 0.1;
+			if (capturing)
+				record(TraceEvent { "input latency", now, latency, Phase::Counter });
+			pendingInput = 0;
+		}
+
+		for (Zone& zone : zones) {
+			zone.lastTime = zone.frameTime;
+			zone.lastCalls = zone.frameCalls;
+			zone.frameTime = 0;
+			zone.frameCalls = 0;
+		}
+	}
+
+	const std::vector<Zone>& getZones() const { return zones; }
+	const Latency& getInputLatency() const { return inputLatency; }
+
+	void startCapture() {
+		trace.clear();
+		capturing = true;
+	}
+
+	void stopCapture() { capturing = false; }
+	bool isCapturing() const { return capturing; }
+
+	// Writes the captured events in the Chrome trace event format (timestamps in microseconds).
+	bool writeChromeTrace(const char* path) const {
+		FILE* file = std::fopen(path, "wb");
+		if (!file)
+			return false;
+
+		std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+		for (size_t i = 0; i < trace.size(); ++i) {
+			const TraceEvent& event = trace[i];
+			const char* separator = i + 1 < trace.size() ? ",\n" : "\n";
+			if (event.phase == Phase::Complete) {
+				std::fprintf(file, "{\"name\":\"%s\",\"cat\":\"editor\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}%s",
+					event.name, event.start / 1000.0, event.duration / 1000.0, separator);
+			} else {
+				std::fprintf(file, "{\"name\":\"%s\",\"cat\":\"editor\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"ms\":%.3f}}%s",
+					event.name, event.start / 1000.0, event.duration / 1e6, separator);
+			}
+		}
+		std::fputs("]}\n", file);
+		return std::fclose(file) == 0;
+	}
+
+private:
+	// Caps a forgotten capture at a few tens of MB
+	static constexpr size_t MAX_TRACE_EVENTS = 1 << 20;
+
+	enum class Phase : uint8_t { Complete, Counter };
+
+	struct TraceEvent {
+		const char* name;
+		uint64_t start;    // ns
+		uint64_t duration; // ns; the value for counters
+		Phase phase;
+	};
+
+	Zone& find(const char* name) {
+		for (Zone& zone : zones) {
+			if (zone.name == name)
+				return zone;
+		}
+		zones.push_back(Zone { name });
+		return zones.back();
+	}
+
+	void record(const TraceEvent& event) {
+		if (trace.size() < MAX_TRACE_EVENTS)
+			trace.push_back(event);
+	}
+
+	std::vector<Zone> zones;
+	std::vector<TraceEvent> trace;
+	bool capturing = false;
+	uint64_t pendingInput = 0;
+	Latency inputLatency;
+};
+
+class ProfileScope {
+public:
+	ProfileScope(Profiler& profiler, const char* name) : profiler(profiler), name(name), start(SDL_GetTicksNS()) {}
+	~ProfileScope() { profiler.addZone(name, start, SDL_GetTicksNS() - start); }
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	Profiler& profiler;
+	const char* name;
+	uint64_t start;
+};
@@ -1,12 +1,14 @@
-$input v_texcoord0, v_pxRange, v_color0
+$input v_texcoord0, v_color0
 
 #include "bgfx_shader.sh"
 
 SAMPLER2D(s_texColor, 0);
+uniform vec4 u_pxRange; // x: distance field range in atlas pixels
 
+// Distance field range in screen pixels: the atlas range over the atlas pixels per screen pixel,
+// so any font size and zoom draw with the same edge width
 float screenPxRange(vec2 v_texcoord0) {
-    float pxRange = 2.0;
-    vec2 unitRange = vec2(pxRange, pxRange) / vec2(textureSize(s_texColor, 0));
+    vec2 unitRange = u_pxRange.xx / vec2(textureSize(s_texColor, 0));
     vec2 screenTexSize = vec2(1.0, 1.0) / fwidth(v_texcoord0);
     return max(0.5 * dot(unitRange, screenTexSize), 1.0);
 }
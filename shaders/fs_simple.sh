@@ -1,7 +0,0 @@
-$input v_color0
-
-#include "bgfx_shader.sh"
-
-void main() {
-    gl_FragColor = v_color0;
-}
\ No newline at end of file
@@ -1,8 +1,10 @@
 vec2 a_position : POSITION = vec2(0.0, 0.0);
 vec2 a_texcoord0 : TEXCOORD0 = vec2(0.0, 0.0);
-vec2 a_texcoord1 : TEXCOORD1 = vec2(0.0, 0.0);
 vec4 a_color0 : COLOR0;
 
 vec2 v_texcoord0 : TEXCOORD0 = vec2(0.0, 0.0);
-vec2 v_pxRange : TEXCOORD1 = vec2(0.0, 0.0);
-vec4 v_color0 : COLOR0;
\ No newline at end of file
+vec4 v_color0 : COLOR0;
+
+vec4 i_data0 : TEXCOORD7;
+vec4 i_data1 : TEXCOORD6;
+vec4 i_data2 : TEXCOORD5;
\ No newline at end of file
@@ -0,0 +1,16 @@
+$input a_position, i_data0, i_data1, i_data2
+$output v_texcoord0, v_color0
+
+#include "bgfx_shader.sh"
+
+// Expands one glyph instance over the unit quad: a_position is the corner (0..1, 0..1),
+// i_data0 the text-space rect (l, b, r, t), i_data1 the atlas rect and i_data2 the colour. The
+// draw transform places and zooms the text.
+void main() {
+    vec2 corner = a_position.xy;
+    v_texcoord0 = mix(i_data1.xy, i_data1.zw, corner);
+    v_color0 = i_data2;
+
+    vec2 position = mix(i_data0.xy, i_data0.zw, corner);
+    gl_Position = mul(u_modelViewProj, vec4(position, 0.0, 1.0));
+}
\ No newline at end of file
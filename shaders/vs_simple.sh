@@ -1,9 +0,0 @@
-$input a_position, a_color0
-$output v_color0
-
-#include "bgfx_shader.sh"
-
-void main() {
-    v_color0 = a_color0;
-    gl_Position = mul(u_proj, vec4(a_position.xy, 0.0, 1.0));
-}
\ No newline at end of file
@@ -0,0 +1,14 @@
+$input a_position, a_texcoord0, a_color0
+$output v_texcoord0, v_color0
+
+#include "bgfx_shader.sh"
+
+// Compact glyph vertex: a_texcoord0 arrives as normalized int16 and a_color0 as RGBA8,
+// there is no per-vertex pixel range. Positions go through u_modelViewProj so the retained mesh,
+// laid out in document space, can be scrolled with bgfx::setTransform.
+void main() {
+    v_texcoord0 = a_texcoord0;
+    v_color0 = a_color0;
+
+    gl_Position = mul(u_modelViewProj, vec4(a_position.xy, 0.0, 1.0));
+}
\ No newline at end of file
@@ -0,0 +1,214 @@
+// shaped_run_cache.h
+// LRU cache of shaped lines for measuring prefix_x.
+//
+// Logs, tables and code repeat the same lines over and over. An entry keeps the pen x after every
+// character (codepoint) of one line, relative to the line start, so the line's total width is its
+// last offset. The line's UTF-8 bytes determine its glyph ids, so the offsets are all that has to
+// be stored. Entries are looked up by a 64-bit hash of those bytes, seeded with the font scale, and
+// the number of characters.
+//
+// A cached line is found with one probe of the index. A line that misses is only inserted the second
+// time it is seen within the last RECENT distinct lines, which a small direct-mapped table of hashes
+// remembers, so unique text costs a hash and a probe of both instead of an insert and an eviction.
+// The index is an open-addressed table of entry slots
+// and the offsets come from the block pool (pool_allocator.h), so evicting and inserting does not
+// touch the global heap once the cache is full. The results of find() and insert() stay valid until
+// the next insert() or clear().
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+
+#include "pool_allocator.h"
+
+class ShapedRunCache {
+public:
+	// Lines of more bytes are measured directly; they are rarely repeated and would crowd out the
+	// rest. Also the most characters an entry can have.
+	static constexpr size_t MAX_RUN_LENGTH = 512;
+
+	static constexpr size_t RECENT = 16384; // power of two
+
+	explicit ShapedRunCache(size_t maxEntries = 16384, size_t maxOffsets = 1 << 21)
+		: recent(RECENT, 0), maxEntries(maxEntries), maxOffsets(maxOffsets) {
+		size_t buckets = 16;
+		while (buckets < 2 * maxEntries)
+			buckets *= 2;
+		index.assign(buckets, NONE);
+	}
+
+	// Hash of one line; seed carries whatever else changes the layout (font scale, line break).
+	static uint64_t hash(const char* chars, size_t count, uint64_t seed) {
+		uint64_t h = 0x9e3779b97f4a7c15ull;
+		auto mix = [&h](uint64_t word) {
+			h = (h ^ word) * 0xbf58476d1ce4e5b9ull;
+			h ^= h >> 31;
+		};
+		mix(seed);
+		mix(count);
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			uint64_t word;
+			std::memcpy(&word, chars + i, 8);
+			mix(word);
+		}
+		if (i < count) {
+			uint64_t word = 0;
+			std::memcpy(&word, chars + i, count - i);
+			mix(word);
+		}
+		// murmur3 finalizer
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ull;
+		h ^= h >> 33;
+		return h;
+	}
+
+	// The count pen offsets cached under key, or nullptr. A hit becomes the most recently used; on a
+	// miss, admit tells whether the line was seen recently and should be insert()ed.
+	const float* find(uint64_t key, size_t count, bool& admit) {
+		admit = false;
+		const uint32_t slot = index[bucketOf(key)];
+		if (slot != NONE && entries[slot].penX.size() == count) {
+			++hits;
+			touch(slot);
+			return entries[slot].penX.data();
+		}
+		++misses;
+		uint64_t& seen = recent[key & (RECENT - 1)];
+		admit = seen == key;
+		seen = key;
+		return nullptr;
+	}
+
+	// Storage for the count pen offsets of a new entry, which the caller fills in. Evicts the least
+	// recently used entries while over budget.
+	float* insert(uint64_t key, size_t count) {
+		if (const uint32_t found = index[bucketOf(key)]; found != NONE)
+			remove(found);
+
+		while (oldest != NONE && (live >= maxEntries || offsets + count > maxOffsets))
+			remove(oldest);
+
+		uint32_t slot;
+		if (free != NONE) {
+			slot = free;
+			free = entries[slot].next;
+		} else {
+			slot = (uint32_t) entries.size();
+			entries.emplace_back();
+		}
+
+		Entry& entry = entries[slot];
+		entry.key = key;
+		entry.penX.resize(count);
+		entry.previous = NONE;
+		entry.next = newest;
+		if (newest != NONE)
+			entries[newest].previous = slot;
+		newest = slot;
+		if (oldest == NONE)
+			oldest = slot;
+		index[bucketOf(key)] = slot;
+		++live;
+		offsets += count;
+		return entry.penX.data();
+	}
+
+	void clear() {
+		std::fill(recent.begin(), recent.end(), 0);
+		entries.clear();
+		std::fill(index.begin(), index.end(), NONE);
+		newest = oldest = free = NONE;
+		live = 0;
+		offsets = 0;
+	}
+
+	size_t size() const { return live; }
+	uint64_t getHits() const { return hits; }
+	uint64_t getMisses() const { return misses; }
+
+private:
+	static constexpr uint32_t NONE = UINT32_MAX;
+
+	// previous/next link the LRU list from newest to oldest; free entries chain through next.
+	struct Entry {
+		uint64_t key = 0;
+		std::vector<float, PoolAllocator<float>> penX;
+		uint32_t previous = NONE;
+		uint32_t next = NONE;
+	};
+
+	// Bucket holding key, or the empty bucket where it would go. Linear probing from the high bits
+	// (the low ones already pick the slot in recent).
+	size_t bucketOf(uint64_t key) const {
+		const size_t mask = index.size() - 1;
+		size_t bucket = (size_t) (key >> 32) & mask;
+		while (index[bucket] != NONE && entries[index[bucket]].key != key)
+			bucket = (bucket + 1) & mask;
+		return bucket;
+	}
+
+	// Empties a bucket, moving later members of its probe run back so none of them is cut off
+	void eraseBucket(size_t hole) {
+		const size_t mask = index.size() - 1;
+		for (size_t bucket = (hole + 1) & mask; index[bucket] != NONE; bucket = (bucket + 1) & mask) {
+			const size_t home = (size_t) (entries[index[bucket]].key >> 32) & mask;
+			if (((bucket - home) & mask) >= ((bucket - hole) & mask)) {
+				index[hole] = index[bucket];
+				hole = bucket;
+			}
+		}
+		index[hole] = NONE;
+	}
+
+	void unlink(uint32_t slot) {
+		Entry& entry = entries[slot];
+		if (entry.previous != NONE)
+			entries[entry.previous].next = entry.next;
+		else
+			newest = entry.next;
+		if (entry.next != NONE)
+			entries[entry.next].previous = entry.previous;
+		else
+			oldest = entry.previous;
+	}
+
+	void touch(uint32_t slot) {
+		if (slot == newest)
+			return;
+		unlink(slot);
+		Entry& entry = entries[slot];
+		entry.previous = NONE;
+		entry.next = newest;
+		entries[newest].previous = slot;
+		newest = slot;
+	}
+
+	// Moves an entry to the free list; its offset storage keeps its capacity for the next insert.
+	void remove(uint32_t slot) {
+		unlink(slot);
+		Entry& entry = entries[slot];
+		eraseBucket(bucketOf(entry.key));
+		--live;
+		offsets -= entry.penX.size();
+		entry.next = free;
+		free = slot;
+	}
+
+	std::vector<uint64_t> recent; // hashes of the last lines looked up, by their low bits
+	std::vector<Entry> entries;
+	std::vector<uint32_t> index; // entry slot by key, NONE for empty buckets; at most half full
+	uint32_t newest = NONE, oldest = NONE, free = NONE;
+	size_t live = 0; // entries in the index
+	size_t offsets = 0; // pen offsets held by the live entries
+	size_t maxEntries;
+	size_t maxOffsets;
+	uint64_t hits = 0, misses = 0;
+};
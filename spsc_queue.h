@@ -0,0 +1,57 @@
+// spsc_queue.h
+// Bounded lock-free queue between exactly one producer and one consumer thread, over N slots that
+// are filled in place and reused. A slot stays the consumer's from front() until pop(), so what it
+// refers to (e.g. arena memory the producer recycles) is safe to read until then.
+//
+// pushed and popped only grow; the slot of the k-th element is k % N. The producer writes pushed,
+// the consumer popped, each with release order, so slot contents are visible to the other side
+// through the acquire load of the counter. Waiting (front() on an empty queue, acquireWait() on a
+// full one) sleeps in std::atomic::wait instead of spinning.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+template <typename T, size_t N>
+class SpscQueue {
+public:
+	// Producer: the slot to fill next, or nullptr while all N are queued or being consumed.
+	T* acquire() {
+		const size_t head = pushed.load(std::memory_order_relaxed);
+		return head - popped.load(std::memory_order_acquire) < N ? &slots[head % N] : nullptr;
+	}
+
+	// Producer: acquire(), waiting for the consumer to pop if every slot is taken.
+	T& acquireWait() {
+		const size_t head = pushed.load(std::memory_order_relaxed);
+		for (size_t tail = popped.load(std::memory_order_acquire); head - tail >= N; tail = popped.load(std::memory_order_acquire))
+			popped.wait(tail, std::memory_order_acquire);
+		return slots[head % N];
+	}
+
+	// Producer: hands the acquired slot to the consumer.
+	void publish() {
+		pushed.store(pushed.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		pushed.notify_one();
+	}
+
+	// Consumer: the oldest published slot, waiting for one if the queue is empty.
+	T& front() {
+		const size_t tail = popped.load(std::memory_order_relaxed);
+		for (size_t head = pushed.load(std::memory_order_acquire); head == tail; head = pushed.load(std::memory_order_acquire))
+			pushed.wait(head, std::memory_order_acquire);
+		return slots[tail % N];
+	}
+
+	// Consumer: gives the front slot back to the producer.
+	void pop() {
+		popped.store(popped.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		popped.notify_one();
+	}
+
+private:
+	T slots[N] = {};
+	alignas(64) std::atomic<size_t> pushed { 0 };
+	alignas(64) std::atomic<size_t> popped { 0 };
+};
@@ -0,0 +1,383 @@
+// text_bench.h
+// Headless benchmark for the text engine, compiled into main.cpp in place of the editor's main()
+// for the editing_text_bench target (EDITING_TEXT_BENCH).
+//
+// Runs without a window, a GPU or a font file: the glyph tables get fixed synthetic metrics and
+// bgfx runs on its Noop renderer, so the retained mesh path executes without drawing anything.
+// The documents are generated from a fixed seed, so numbers are comparable between runs, machines
+// and releases. Each benchmark prints ns/op and heap allocations/op, counted by heap_counter.h over
+// operator new, SDL and bgfx.
+//
+//   editing_text_bench [filter]   runs the benchmarks whose name contains filter
+//
+// Before measuring anything it checks that batched typing keeps its order (bench_check_typing) and
+// exits with 1 if it does not.
+
+#pragma once
+
+#include <cstdlib>
+
+// Deterministic ASCII prose: words of 1-10 letters, lines of 40-100 characters
+std::string bench_corpus(size_t size, uint32_t seed = 12345) {
+	std::string text;
+	text.reserve(size);
+	uint32_t state = seed;
+	auto next = [&state] { state = state * 1664525u + 1013904223u; return state >> 8; };
+
+	size_t line = 0;
+	size_t lineLength = 40 + next() % 61;
+	while (text.size() < size) {
+		const size_t word = 1 + next() % 10;
+		for (size_t i = 0; i < word && text.size() < size; ++i)
+			text.push_back((char) ((next() % 5 == 0 ? 'A' : 'a') + next() % 26));
+		line += word + 1;
+		if (text.size() < size)
+			text.push_back(line >= lineLength ? '\n' : ' ');
+		if (line >= lineLength) {
+			line = 0;
+			lineLength = 40 + next() % 61;
+		}
+	}
+	return text;
+}
+
+// bench_corpus with every eighth letter outside ASCII: mostly two-byte Latin-1 letters, some
+// three-byte ones past it (which the benchmark face draws as '?')
+std::string bench_utf8_corpus(size_t size, uint32_t seed = 4242) {
+	// e acute, u diaeresis, sharp s, A ring, n tilde, l stroke, euro sign
+	static const char* const letters[] = { "\xc3\xa9", "\xc3\xbc", "\xc3\x9f", "\xc3\x85", "\xc3\xb1", "\xc5\x82", "\xe2\x82\xac" };
+	const std::string ascii = bench_corpus(size, seed);
+	std::string text;
+	text.reserve(size + size / 4);
+	uint32_t state = seed;
+	for (char c : ascii) {
+		state = state * 1664525u + 1013904223u;
+		if (c >= 'a' && c <= 'z' && (state >> 8) % 8 == 0)
+			text += letters[(state >> 16) % 7];
+		else
+			text.push_back(c);
+	}
+	return text;
+}
+
+// Fixed metrics in place of acquireFont: varying advances, a few kerning pairs and one ready atlas
+// glyph per printable character. The atlas is never created, so there is no texture or cache.
+std::shared_ptr<FontFace> bench_font_face() {
+	auto face = std::make_shared<FontFace>();
+	GlyphTables& tables = face->tables;
+	tables.fsScale = 24.0;
+	tables.lineHeight = 28.0;
+	std::fill(tables.kerning.begin(), tables.kerning.end(), 0.0f);
+	for (int c = 0; c < 256; ++c) {
+		tables.advance[c] = 8.0f + (float) (c % 7);
+		tables.glyph[c] = nullptr;
+		if (c > ' ' && c != 127) {
+			AtlasGlyph* glyph = face->atlas.find((msdf_atlas::unicode_t) c);
+			*glyph = AtlasGlyph { 0.0f, -0.2f, 0.45f, 0.75f, 0.0f, 0.0f, 0.01f, 0.01f, (msdf_atlas::unicode_t) c, AtlasGlyph::State::Ready };
+			tables.glyph[c] = glyph;
+		}
+	}
+	tables.advance['\n'] = tables.advance['\r'] = 0.0f;
+	tables.advance['\t'] = 4.0f * tables.advance[' '];
+	for (const char* pair : { "AV", "VA", "To", "Te", "Ty", "LT", "Wa", "Yo" })
+		tables.kerning[((unsigned char) pair[0] << 8) | (unsigned char) pair[1]] = -1.5f;
+	update_glyph_corners(*face);
+	return face;
+}
+
+static std::shared_ptr<FontFace> g_BenchFace;
+
+void bench_document(text_control& doc, const std::string& text) {
+	doc.face = g_BenchFace;
+	doc.string.assign(text.data(), text.size());
+	rebuild_text_index(&doc);
+	stb_textedit_initialize_state(&doc.state, 0);
+#if !defined(TEXT_STORAGE_GAP_BUFFER)
+	doc.undo.clear();
+#endif
+}
+
+// Typing in overwrite mode through the per-frame batch the way handleEvent feeds it: "x", Return
+// and "y" typed over "abc" within one frame have to come out in that order.
+bool bench_check_typing() {
+	static text_control doc; // large; lives outside the stack
+	bench_document(doc, "abc");
+	doc.state.insert_mode = 1;
+	std::string pending;
+	text_type(&doc, pending, "x", 1);
+	pending.append("\n", 1); // Return is always batched, see handleEvent
+	text_type(&doc, pending, "y", 1);
+	text_flush_typed(&doc, pending);
+
+	std::string text(doc.string.size(), '\0');
+	doc.string.copyTo(0, text.size(), text.data());
+	if (text == "x\nyc")
+		return true;
+	std::fprintf(stderr, "overwrite typing out of order: expected \"x\\nyc\", got \"");
+	for (char c : text) {
+		if (c == '\n')
+			std::fputs("\\n", stderr);
+		else
+			std::fputc(c, stderr);
+	}
+	std::fputs("\"\n", stderr);
+	return false;
+}
+
+// Times body(ops) where body performs ops operations and returns how many it actually did.
+// setup runs untimed before each measurement.
+template <typename Setup, typename Body>
+void bench_run(const char* filter, const char* name, uint64_t ops, Setup&& setup, Body&& body) {
+	if (!std::strstr(name, filter))
+		return;
+
+	setup();
+	const uint64_t allocations = heapCounts().total();
+	const auto start = std::chrono::steady_clock::now();
+	const uint64_t done = body(ops);
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	const uint64_t allocated = heapCounts().total() - allocations;
+
+	std::printf("%-36s %10llu ops %14.1f ns/op %10.3f allocs/op\n", name, (unsigned long long) done,
+		done ? seconds * 1e9 / done : 0.0, done ? (double) allocated / done : 0.0);
+	std::fflush(stdout);
+}
+
+void run_benchmarks(const char* filter) {
+	static text_control doc; // large; lives outside the stack
+	const std::string corpus = bench_corpus(4 << 20);
+	auto setup = [&] { bench_document(doc, corpus); };
+
+	// Typing and deleting through stb_textedit_key at the start, middle and end of a 4 MB document
+	const struct { const char* name; double at; } positions[] = { { "start", 0.0 }, { "middle", 0.5 }, { "end", 1.0 } };
+	for (const auto& position : positions) {
+		char name[64];
+		SDL_snprintf(name, sizeof(name), "type/%s", position.name);
+		bench_run(filter, name, 100000, setup, [&](uint64_t ops) {
+			doc.state.cursor = (int) (position.at * doc.index.size());
+			for (uint64_t i = 0; i < ops; ++i)
+				stb_textedit_key(&doc, &doc.state, 'a' + (int) (i % 26));
+			return ops;
+		});
+
+		SDL_snprintf(name, sizeof(name), "backspace/%s", position.name);
+		bench_run(filter, name, 100000, setup, [&](uint64_t ops) {
+			doc.state.cursor = std::max(1, (int) (position.at * doc.index.size()));
+			uint64_t i = 0;
+			for (; i < ops && doc.state.cursor > 0; ++i)
+				stb_textedit_key(&doc, &doc.state, STB_TEXTEDIT_K_BACKSPACE);
+			return i;
+		});
+	}
+
+	// One paste into the middle of the document per size; the clipboard copy itself is not timed
+	for (size_t size : { (size_t) 1 << 10, (size_t) 64 << 10, (size_t) 1 << 20, (size_t) 16 << 20, (size_t) 100 << 20 }) {
+		char name[64];
+		SDL_snprintf(name, sizeof(name), "paste/%zuKB", size >> 10);
+		char* buffer = nullptr;
+		bench_run(filter, name, 1, [&] {
+			setup();
+			doc.state.cursor = (int) doc.index.size() / 2;
+			// Generated here, so a filter that skips the paste benchmarks skips the clips too
+			const std::string clip = bench_corpus(size, 777);
+			buffer = (char*) std::malloc(size);
+			std::memcpy(buffer, clip.data(), size);
+		}, [&](uint64_t) {
+			text_paste(&doc, OwnedText(buffer, std::free), size);
+			return (uint64_t) 1;
+		});
+	}
+
+	// Cursor navigation, each key repeated from the middle of the document
+	const struct { const char* name; unsigned key; } moves[] = {
+		{ "move/right", STB_TEXTEDIT_K_RIGHT }, { "move/left", STB_TEXTEDIT_K_LEFT },
+		{ "move/down", STB_TEXTEDIT_K_DOWN }, { "move/up", STB_TEXTEDIT_K_UP },
+		{ "move/word_right", STB_TEXTEDIT_K_WORDRIGHT }, { "move/line_end", STB_TEXTEDIT_K_LINEEND },
+	};
+	for (const auto& move : moves) {
+		bench_run(filter, move.name, 100000, setup, [&](uint64_t ops) {
+			doc.state.cursor = (int) doc.index.size() / 2;
+			for (uint64_t i = 0; i < ops; ++i)
+				stb_textedit_key(&doc, &doc.state, (int) move.key);
+			return ops;
+		});
+	}
+
+	// The same on UTF-8 text, where every character stb looks at goes through the codepoint index
+	const std::string utf8 = bench_utf8_corpus(4 << 20);
+	auto setupUtf8 = [&] { bench_document(doc, utf8); };
+	for (const auto& move : { moves[0], moves[4] }) {
+		char name[64];
+		SDL_snprintf(name, sizeof(name), "%s_utf8", move.name);
+		bench_run(filter, name, 100000, setupUtf8, [&](uint64_t ops) {
+			doc.state.cursor = (int) doc.index.size() / 2;
+			for (uint64_t i = 0; i < ops; ++i)
+				stb_textedit_key(&doc, &doc.state, (int) move.key);
+			return ops;
+		});
+	}
+	bench_run(filter, "type/utf8_middle", 100000, setupUtf8, [&](uint64_t ops) {
+		doc.state.cursor = (int) doc.index.size() / 2;
+		for (uint64_t i = 0; i < ops; ++i)
+			stb_textedit_key(&doc, &doc.state, i % 4 ? 'a' + (int) (i % 26) : 0xe0 + (int) (i % 26));
+		return ops;
+	});
+
+	// The stb layout callbacks over the whole document
+	bench_run(filter, "layout_func/line", 0, setup, [&](uint64_t) {
+		StbTexteditRow row;
+		uint64_t rows = 0;
+		for (int start = 0; start < (int) doc.index.size(); start += row.num_chars, ++rows)
+			layout_func(&row, &doc, start);
+		return rows;
+	});
+	bench_run(filter, "get_width_func/char", 0, setup, [&](uint64_t) {
+		float width = 0.0f;
+		const int length = (int) doc.index.size();
+		for (int i = 0; i < length; ++i)
+			width += get_width_func(&doc, i, 0);
+		// keeps the loop from being optimized away
+		if (width == 1.0f)
+			std::puts("");
+		return (uint64_t) length;
+	});
+	bench_run(filter, "rebuild_text_index/char", 0, setup, [&](uint64_t) {
+		rebuild_text_index(&doc);
+		return (uint64_t) doc.index.size();
+	});
+	bench_run(filter, "rebuild_text_index/utf8_char", 0, setupUtf8, [&](uint64_t) {
+		rebuild_text_index(&doc);
+		return (uint64_t) doc.index.size();
+	});
+	// A log-like document: the same few hundred lines over and over, mostly shaped-run cache hits
+	std::string repeated;
+	{
+		const std::string lines = bench_corpus(32 << 10, 99);
+		while (repeated.size() < corpus.size())
+			repeated += lines;
+		repeated.resize(repeated.rfind('\n', corpus.size()) + 1);
+	}
+	// Lays every line out once, the way scrolling through the whole document does, in characters
+	auto shapeLines = [&](uint64_t) {
+		for (int line = 0; line < (int) doc.line_starts.size(); ++line)
+			line_prefix_x(&doc, line);
+		return (uint64_t) doc.index.size();
+	};
+	bench_run(filter, "shape_lines/char", 0, setup, shapeLines);
+	bench_run(filter, "shape_lines/repeated_char", 0, [&] { bench_document(doc, repeated); }, shapeLines);
+
+	// Find-all over the 4 MB document, in bytes scanned: a two-letter query whose prefix filter hits
+	// often, a longer one from the middle that is rarely a candidate, and the upkeep of a complete
+	// search through typing in front of all its matches
+	const struct { const char* name; std::string query; } queries[] = {
+		{ "find_all/common_byte", "ab" }, { "find_all/rare_byte", corpus.substr(corpus.size() / 2, 12) },
+	};
+	for (const auto& query : queries) {
+		bench_run(filter, query.name, 0, setup, [&](uint64_t) {
+			text_find(&doc, query.query.data(), query.query.size());
+			while (!text_search_step(&doc)) {}
+			if (doc.search.getMatches().empty())
+				std::puts("no match");
+			return (uint64_t) doc.string.size();
+		});
+	}
+	bench_run(filter, "find_all/type", 10000, [&] {
+		setup();
+		text_find(&doc, "ab", 2);
+		while (!text_search_step(&doc)) {}
+	}, [&](uint64_t ops) {
+		doc.state.cursor = doc.line_starts[10];
+		for (uint64_t i = 0; i < ops; ++i)
+			stb_textedit_key(&doc, &doc.state, 'a' + (int) (i % 26));
+		return ops;
+	});
+
+	// Glyph quads of one 800x600 screen, on the CPU and through the retained mesh with bgfx Noop
+	bench_run(filter, "glyph_quads/quad", 1000, setup, [&](uint64_t ops) {
+		std::vector<GlyphVertex> vertices;
+		uint64_t quads = 0;
+		const TextViewport view = text_viewport(0.0f, -1000.0f * getLineHeight(&doc));
+		for (uint64_t i = 0; i < ops; ++i) {
+			size_t used = 0;
+			for_each_visible_run(&doc, view, [&](int line, int begin, int end) {
+				const float y = line * getLineHeight(&doc);
+				if (vertices.size() < 4 * (used + end - begin))
+					vertices.resize(4 * (used + end - begin));
+				for_each_glyph_span(&doc, begin, end, [&](const unsigned char* chars, const uint32_t* glyphs, const float* penX, size_t count) {
+					if (chars)
+						writeGlyphQuadRun(doc.face->tables, vertices.data() + 4 * used, chars, penX, count, 0.0f, y);
+					else
+						writeGlyphQuadRun(doc.face->tables, vertices.data() + 4 * used, glyphs, penX, count, 0.0f, y);
+					used += count;
+				});
+			});
+			quads += used;
+		}
+		return quads;
+	});
+	TextMesh mesh;
+	bench_run(filter, "updateTextMesh/full", 1000, setup, [&](uint64_t ops) {
+		for (uint64_t i = 0; i < ops; ++i) {
+			doc.mesh_dirty_from = 0;
+			updateTextMesh(mesh, &doc, 0.0f, -1000.0f * getLineHeight(&doc));
+			submit_frame();
+		}
+		return ops;
+	});
+	bench_run(filter, "updateTextMesh/type", 1000, setup, [&](uint64_t ops) {
+		doc.state.cursor = doc.line_starts[1010];
+		for (uint64_t i = 0; i < ops; ++i) {
+			stb_textedit_key(&doc, &doc.state, 'a' + (int) (i % 26));
+			updateTextMesh(mesh, &doc, 0.0f, -1000.0f * getLineHeight(&doc));
+			submit_frame();
+		}
+		return ops;
+	});
+	destroyTextMesh(mesh);
+
+	// A form of 512 one-line text fields sharing the face, all drawn through one TextBatch
+	static text_control fields[512];
+	bench_run(filter, "text_batch/field", 1000, [&] {
+		for (int i = 0; i < 512; ++i)
+			bench_document(fields[i], bench_corpus(24 + i % 17, 1000 + i).substr(0, 24 + i % 17));
+	}, [&](uint64_t ops) {
+		TextBatch batch;
+		for (uint64_t i = 0; i < ops; ++i) {
+			for (int k = 0; k < 512; ++k) {
+				const float x = 10.0f + (k % 4) * 200.0f, y = 10.0f + (k / 4) * 30.0f;
+				addTextToBatch(batch, &fields[k], x, y, text_viewport(x, y, x, y, x + 190.0f, y + 28.0f));
+			}
+			submitTextBatch(batch, BGFX_INVALID_HANDLE, GlyphUniforms());
+			submit_frame();
+		}
+		destroyTextBatch(batch);
+		return ops * 512;
+	});
+}
+
+int main(int argc, char* args[]) {
+	const char* filter = argc > 1 ? args[1] : "";
+	countSDLAllocations();
+
+	bgfx::Init init;
+	init.type = bgfx::RendererType::Noop;
+	init.allocator = heapCountingAllocator();
+	init.resolution.width = SCREEN_WIDTH;
+	init.resolution.height = SCREEN_HEIGHT;
+	if (!bgfx::init(init)) {
+		std::fprintf(stderr, "bgfx Noop renderer failed to initialize\n");
+		return 1;
+	}
+	GlyphVertex::init();
+
+	g_AppContext.jobs.start();
+	g_BenchFace = bench_font_face();
+	const bool checked = bench_check_typing();
+	if (checked)
+		run_benchmarks(filter);
+
+	g_BenchFace.reset();
+	g_AppContext.jobs.stop();
+	bgfx::shutdown();
+	return checked ? 0 : 1;
+}
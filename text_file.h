@@ -0,0 +1,204 @@
+// text_file.h
+// Document file I/O for the text storage backends.
+//
+//   MappedFile     - read-only memory mapping of a whole file. Opening is O(1) and pages fault in
+//                    as the text is touched; the piece table uses it directly as its original
+//                    buffer (PieceTable::assignShared).
+//   writeTextFile  - streams a storage out span by span (vectored writes where the platform has
+//                    them) into a temporary file that then replaces the target, so the whole text
+//                    is never flattened and a failed save leaves the old file intact. On POSIX the
+//                    replacement takes over the target's mode and owner.
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdio>
+#include <algorithm>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+class MappedFile {
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile() { close(); }
+
+	bool open(const std::string& path) {
+		close();
+#if defined(_WIN32)
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize)) {
+			CloseHandle(file);
+			return false;
+		}
+		length = (size_t) fileSize.QuadPart;
+		if (length > 0) {
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		}
+		CloseHandle(file); // the mapping keeps the file open
+		if (length > 0 && !view) {
+			close();
+			return false;
+		}
+#else
+		const int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat info;
+		if (fstat(fd, &info) != 0) {
+			::close(fd);
+			return false;
+		}
+		length = (size_t) info.st_size;
+		if (length > 0) {
+			view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (view == MAP_FAILED)
+				view = nullptr;
+		}
+		::close(fd); // the mapping keeps the file open
+		if (length > 0 && !view) {
+			length = 0;
+			return false;
+		}
+#endif
+		return true;
+	}
+
+	void close() {
+#if defined(_WIN32)
+		if (view) UnmapViewOfFile(view);
+		if (mapping) CloseHandle(mapping);
+		mapping = nullptr;
+#else
+		if (view) munmap(view, length);
+#endif
+		view = nullptr;
+		length = 0;
+	}
+
+	// Empty files are not mapped; data() is then a valid pointer to nothing.
+	const char* data() const { return view ? static_cast<const char*>(view) : ""; }
+	size_t size() const { return length; }
+
+private:
+	void* view = nullptr;
+	size_t length = 0;
+#if defined(_WIN32)
+	HANDLE mapping = nullptr;
+#endif
+};
+
+// Moves the finished file from over to, replacing to as one step: readers of to see the old file
+// or the new one, never a part.
+inline bool replaceFile(const std::string& from, const std::string& to) {
+#if defined(_WIN32)
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+// Writes every span of storage (anything with size() and forEachSpan(), see text_storage.h) to
+// path + ".tmp" and renames that over path.
+template <typename Storage>
+bool writeTextFile(const Storage& storage, const std::string& path) {
+	const std::string temporary = path + ".tmp";
+	bool ok = true;
+
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(temporary.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	// WriteFileGather needs page-aligned buffers, so one WriteFile per span
+	storage.forEachSpan(0, storage.size(), [&](const char* span, size_t spanLength) {
+		while (ok && spanLength > 0) {
+			DWORD written = 0;
+			const DWORD chunk = (DWORD) std::min<size_t>(spanLength, 1u << 30);
+			ok = WriteFile(file, span, chunk, &written, nullptr) && written > 0;
+			span += written;
+			spanLength -= written;
+		}
+	});
+	ok = CloseHandle(file) && ok;
+	ok = ok && replaceFile(temporary, path);
+#else
+	// The replacement keeps the mode and, where permitted, the owner of the file it replaces, so a
+	// save neither drops +x nor opens up a private file. It starts private until then; a new file
+	// gets the usual 0666 less the umask.
+	struct stat original;
+	const bool replacing = stat(path.c_str(), &original) == 0;
+	const int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, replacing ? 0600 : 0666);
+	if (fd < 0)
+		return false;
+	if (replacing) {
+		// Only root can give a file away, anyone can keep its group if they are in it. A file that
+		// ends up with another owner does not take over set-user/group-ID bits. Changing the owner
+		// may clear those bits too, so the mode goes second.
+		if (fchown(fd, original.st_uid, original.st_gid) != 0 && fchown(fd, (uid_t) -1, original.st_gid) != 0)
+			original.st_mode &= ~(mode_t) (S_ISUID | S_ISGID);
+		ok = fchmod(fd, original.st_mode & 07777) == 0;
+	}
+
+	// Gathers up to IOV_MAX spans per writev and resumes after short writes
+	iovec vectors[IOV_MAX];
+	int count = 0;
+	auto flush = [&] {
+		iovec* next = vectors;
+		while (ok && count > 0) {
+			const ssize_t written = writev(fd, next, count);
+			if (written < 0) {
+				ok = false;
+				break;
+			}
+			size_t remaining = (size_t) written;
+			while (count > 0 && remaining >= next->iov_len) {
+				remaining -= next->iov_len;
+				++next;
+				--count;
+			}
+			if (count > 0) {
+				next->iov_base = static_cast<char*>(next->iov_base) + remaining;
+				next->iov_len -= remaining;
+			}
+		}
+		count = 0;
+	};
+	storage.forEachSpan(0, storage.size(), [&](const char* span, size_t spanLength) {
+		if (spanLength == 0)
+			return;
+		vectors[count++] = iovec { const_cast<char*>(span), spanLength };
+		if (count == IOV_MAX)
+			flush();
+	});
+	flush();
+	ok = fsync(fd) == 0 && ok;
+	ok = ::close(fd) == 0 && ok;
+	// A mapping of the old file stays valid, it keeps the replaced inode alive
+	ok = ok && replaceFile(temporary, path);
+#endif
+
+	if (!ok)
+		std::remove(temporary.c_str());
+	return ok;
+}
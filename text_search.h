@@ -0,0 +1,263 @@
+// text_search.h
+// Find, find-next and find-all over a text storage (text_storage.h).
+//
+//   search_bytes  - substring kernel over one contiguous run. The positions where both of the
+//                   needle's first two bytes match are found 16 at a time (two loads one byte apart,
+//                   compared against the broadcast bytes with SSE2/NEON), and only those candidates
+//                   are confirmed with memcmp. A one-byte needle is memchr.
+//   TextSearch    - the matches of one query in a document, as sorted byte offsets. step() scans at
+//                   most a given number of bytes, so scanning a multi-MB log can be spread over
+//                   frames instead of blocking the event loop; edited() follows an edit by moving
+//                   the matches after it and rescanning only the bytes around it. Matches may
+//                   overlap ("aa" is found twice in "aaa").
+//
+// The storage is walked span by span through forEachSpan, never flattened. A match across two
+// spans is found by carrying the last (needle size - 1) bytes of a span over to the next one.
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SEARCH_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define SEARCH_NEON
+#include <arm_neon.h>
+#endif
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+// Index of the lowest set bit of a non-zero mask
+inline int search_lowest_bit(uint64_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long index;
+	if ((uint32_t) mask) {
+		_BitScanForward(&index, (uint32_t) mask);
+		return (int) index;
+	}
+	_BitScanForward(&index, (uint32_t) (mask >> 32));
+	return (int) index + 32;
+#else
+	return __builtin_ctzll(mask);
+#endif
+}
+
+// Calls found(offset) for every offset in text where needle starts, in order, until found returns
+// false. Returns false if it was stopped that way.
+template <typename Found>
+bool search_bytes(const char* text, size_t size, const char* needle, size_t needleSize, Found&& found) {
+	if (needleSize == 0 || size < needleSize)
+		return true;
+	if (needleSize == 1) {
+		for (const char* p = text; (p = (const char*) std::memchr(p, needle[0], text + size - p)); ++p) {
+			if (!found((size_t) (p - text)))
+				return false;
+		}
+		return true;
+	}
+
+	// i + 15 <= last keeps both loads and every candidate's memcmp inside the text
+	const size_t last = size - needleSize; // last possible start
+	size_t i = 0;
+#if defined(SEARCH_SSE2)
+	const __m128i first = _mm_set1_epi8(needle[0]), second = _mm_set1_epi8(needle[1]);
+	for (; i + 15 <= last; i += 16) {
+		const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i + 1));
+		uint64_t candidates = (uint32_t) _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, second)));
+		for (; candidates; candidates &= candidates - 1) {
+			const size_t at = i + search_lowest_bit(candidates);
+			if (std::memcmp(text + at + 2, needle + 2, needleSize - 2) == 0 && !found(at))
+				return false;
+		}
+	}
+#elif defined(SEARCH_NEON)
+	const uint8x16_t first = vdupq_n_u8((uint8_t) needle[0]), second = vdupq_n_u8((uint8_t) needle[1]);
+	for (; i + 15 <= last; i += 16) {
+		const uint8x16_t a = vld1q_u8(reinterpret_cast<const uint8_t*>(text + i));
+		const uint8x16_t b = vld1q_u8(reinterpret_cast<const uint8_t*>(text + i + 1));
+		const uint8x16_t both = vandq_u8(vceqq_u8(a, first), vceqq_u8(b, second));
+		// No movemask on NEON: a narrowing shift leaves four bits per byte, the top one of which is kept
+		uint64_t candidates = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(both), 4)), 0) & 0x8888888888888888ull;
+		for (; candidates; candidates &= candidates - 1) {
+			const size_t at = i + (search_lowest_bit(candidates) >> 2);
+			if (std::memcmp(text + at + 2, needle + 2, needleSize - 2) == 0 && !found(at))
+				return false;
+		}
+	}
+#endif
+	for (; i <= last; ++i) {
+		if (text[i] == needle[0] && text[i + 1] == needle[1] && std::memcmp(text + i + 2, needle + 2, needleSize - 2) == 0 && !found(i))
+			return false;
+	}
+	return true;
+}
+
+class TextSearch {
+public:
+	// Bytes step() scans per call when the caller has no better budget, about a millisecond
+	static constexpr size_t SLICE = 4 << 20;
+
+	// Starts over with a new query (bytes, matched exactly); an empty one ends the search
+	void setQuery(const char* text, size_t size) {
+		query.assign(text, size);
+		restart();
+	}
+
+	// Forgets the matches, e.g. when the whole text was replaced
+	void restart() {
+		matches.clear();
+		scanned = 0;
+		complete = query.empty();
+	}
+
+	bool active() const { return !query.empty(); }
+	const std::string& getQuery() const { return query; }
+
+	// Whether every match is in getMatches(); until then it holds those found so far, in the text
+	// before getScanned()
+	bool isComplete() const { return complete; }
+	size_t getScanned() const { return scanned; }
+	const std::vector<size_t>& getMatches() const { return matches; }
+
+	// Scans at most budget more bytes; returns isComplete()
+	template <typename Text>
+	bool step(const Text& text, size_t budget) {
+		if (complete)
+			return true;
+		const size_t starts = text.size() >= query.size() ? text.size() - query.size() + 1 : 0;
+		const size_t to = std::min(starts, scanned + budget);
+		scan(text, scanned, to, matches);
+		scanned = to;
+		if (to == starts) {
+			scanned = text.size(); // stays the end of the text through edited()
+			complete = true;
+		}
+		return complete;
+	}
+
+	// Keeps the matches in step with an edit that replaced removed bytes at byte with inserted
+	// ones (already in text). The matches that overlapped the removed bytes are dropped, those after
+	// them move, and the starts that can reach into the inserted bytes are scanned again. An edit
+	// the scan has not got past yet only sends it back to just before the edit.
+	template <typename Text>
+	void edited(const Text& text, size_t byte, size_t removed, size_t inserted) {
+		if (query.empty())
+			return;
+		const size_t from = byte >= query.size() - 1 ? byte - (query.size() - 1) : 0; // first start that reaches the edit
+		if (scanned <= from && !complete)
+			return;
+		const auto first = std::lower_bound(matches.begin(), matches.end(), from);
+		if (scanned < byte + removed) {
+			matches.erase(first, matches.end());
+			scanned = from;
+			complete = false;
+			return;
+		}
+
+		const auto moved = matches.erase(first, std::lower_bound(first, matches.end(), byte + removed));
+		for (auto it = moved; it != matches.end(); ++it)
+			*it = *it - removed + inserted;
+		scanned = scanned - removed + inserted;
+
+		rescanned.clear();
+		scan(text, from, byte + inserted, rescanned);
+		matches.insert(moved, rescanned.begin(), rescanned.end());
+	}
+
+	// The first match at or after byte, else the first one (wrapping around). Scans as far as it
+	// takes; false if there is no match at all.
+	template <typename Text>
+	bool next(const Text& text, size_t byte, size_t& match) {
+		for (;;) {
+			const auto it = std::lower_bound(matches.begin(), matches.end(), byte);
+			if (it != matches.end()) {
+				match = *it;
+				return true;
+			}
+			if (complete)
+				break;
+			step(text, SLICE);
+		}
+		if (matches.empty())
+			return false;
+		match = matches.front();
+		return true;
+	}
+
+	// The last match before byte, else the last one (wrapping around); see next()
+	template <typename Text>
+	bool previous(const Text& text, size_t byte, size_t& match) {
+		if (scanned < byte)
+			step(text, byte - scanned);
+		const auto it = std::lower_bound(matches.begin(), matches.end(), byte);
+		if (it != matches.begin()) {
+			match = *(it - 1);
+			return true;
+		}
+		while (!step(text, SLICE)) {}
+		if (matches.empty())
+			return false;
+		match = matches.back();
+		return true;
+	}
+
+private:
+	// Appends the matches that start in [from, to) to out, in order
+	template <typename Text>
+	void scan(const Text& text, size_t from, size_t to, std::vector<size_t>& out) {
+		const size_t size = query.size();
+		const size_t end = std::min(text.size(), to + size - 1);
+		if (to <= from || end < from + size)
+			return;
+
+		carry.clear();
+		size_t carryAt = from; // text offset of carry[0]
+		size_t at = from;      // of the current span
+		text.forEachSpan(from, end - from, [&](const char* span, size_t length) {
+			// A match across the seam starts in the carried bytes; it is found at the span holding
+			// its last byte, where the carry has all the others
+			if (!carry.empty()) {
+				const size_t carried = carry.size();
+				carry.append(span, std::min(length, size - 1));
+				search_bytes(carry.data(), carry.size(), query.data(), size, [&](size_t i) {
+					if (i < carried)
+						out.push_back(carryAt + i);
+					return i < carried;
+				});
+				carry.resize(carried);
+			}
+			search_bytes(span, length, query.data(), size, [&](size_t i) {
+				out.push_back(at + i);
+				return true;
+			});
+
+			// The last size - 1 bytes so far go on to the next span
+			if (length >= size - 1) {
+				carry.assign(span + length - (size - 1), size - 1);
+				carryAt = at + length - (size - 1);
+			} else {
+				carry.append(span, length);
+				if (carry.size() > size - 1) {
+					carryAt += carry.size() - (size - 1);
+					carry.erase(0, carry.size() - (size - 1));
+				}
+			}
+			at += length;
+		});
+	}
+
+	std::string query;
+	std::vector<size_t> matches;    // byte offsets, ascending
+	size_t scanned = 0;             // every match starting before it is in matches
+	bool complete = true;
+	std::string carry;              // the bytes before the next span, see scan()
+	std::vector<size_t> rescanned;  // edited()'s scratch; both keep their capacity
+};
@@ -0,0 +1,451 @@
+// text_storage.h
+// Storage backends for text_control. Neither shifts the whole tail of the document on an edit the
+// way std::string::insert/erase do.
+//
+//   GapBuffer<T>  - contiguous array with a movable hole at the last edit point; an edit at the
+//                   cursor is O(1) amortized. Also used for per-line side tables (e.g.
+//                   LineWidths).
+//   PieceTable    - read-only original buffer plus an append-only add buffer, described by a list
+//                   of pieces. Edits never move text, only split or trim pieces. The pieces are
+//                   kept in chunks of about CHUNK whose lengths are summed in a Fenwick tree
+//                   (fenwick_tree.h), so finding, splitting, inserting and erasing a piece cost
+//                   O(log chunks) plus a walk within one chunk, however many edits came before.
+//
+// Both expose the same minimal interface used by the stb_textedit callbacks and the renderer:
+// size(), operator[], insert(), erase(), assign(), copyTo() and forEachSpan(), the latter handing
+// out contiguous runs so the text can be walked without flattening it. adopt() inserts a buffer the
+// caller hands over, which the piece table references in place instead of copying. assignShared()
+// does the same for the whole document, e.g. a read-only file mapping (see text_file.h).
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "fenwick_tree.h"
+
+// Heap text handed over together with the function that frees it (e.g. SDL_free), see adopt()
+using OwnedText = std::unique_ptr<char, void (*)(void*)>;
+
+template <typename T>
+class GapBuffer {
+public:
+	GapBuffer() = default;
+	GapBuffer(size_t count, const T& value) { assign(count, value); }
+
+	size_t size() const { return data.size() - gapSize(); }
+	bool empty() const { return size() == 0; }
+
+	T& operator[](size_t i) { return data[i < gapStart ? i : i + gapSize()]; }
+	const T& operator[](size_t i) const { return data[i < gapStart ? i : i + gapSize()]; }
+
+	void insert(size_t pos, const T* values, size_t count) {
+		moveGap(pos);
+		reserveGap(count);
+		std::copy(values, values + count, data.begin() + gapStart);
+		gapStart += count;
+	}
+
+	void insert(size_t pos, size_t count, const T& value) {
+		moveGap(pos);
+		reserveGap(count);
+		std::fill(data.begin() + gapStart, data.begin() + gapStart + count, value);
+		gapStart += count;
+	}
+
+	void erase(size_t pos, size_t count) {
+		moveGap(pos);
+		gapEnd += count;
+	}
+
+	// Same as insert(); the text has to be copied into the gap, the buffer is released right away
+	void adopt(size_t pos, OwnedText text, size_t count) {
+		insert(pos, text.get(), count);
+	}
+
+	void assign(const T* values, size_t count) {
+		data.assign(values, values + count);
+		gapStart = gapEnd = count;
+	}
+
+	// Same as assign(); the gap buffer needs the text in its own array, the owner is not kept
+	void assignShared(const T* values, size_t count, std::shared_ptr<const void>) {
+		assign(values, count);
+	}
+
+	void unshare() {}
+
+	void assign(size_t count, const T& value) {
+		data.assign(count, value);
+		gapStart = gapEnd = count;
+	}
+
+	void clear() {
+		data.clear();
+		gapStart = gapEnd = 0;
+	}
+
+	void copyTo(size_t pos, size_t count, T* out) const {
+		forEachSpan(pos, count, [&](const T* span, size_t length) {
+			out = std::copy(span, span + length, out);
+		});
+	}
+
+	// Calls fn(const T* span, size_t length) for the (at most two) contiguous runs covering
+	// [pos, pos + count).
+	template <typename Fn>
+	void forEachSpan(size_t pos, size_t count, Fn&& fn) const {
+		const size_t end = pos + count;
+		if (pos < gapStart) {
+			const size_t before = std::min(end, gapStart);
+			fn(data.data() + pos, before - pos);
+			pos = before;
+		}
+		if (pos < end)
+			fn(data.data() + pos + gapSize(), end - pos);
+	}
+
+private:
+	static constexpr size_t MIN_GAP = 64;
+
+	size_t gapSize() const { return gapEnd - gapStart; }
+
+	void moveGap(size_t pos) {
+		if (pos < gapStart) {
+			std::move_backward(data.begin() + pos, data.begin() + gapStart, data.begin() + gapEnd);
+			gapEnd -= gapStart - pos;
+			gapStart = pos;
+		} else if (pos > gapStart) {
+			const size_t count = pos - gapStart;
+			std::move(data.begin() + gapEnd, data.begin() + gapEnd + count, data.begin() + gapStart);
+			gapStart += count;
+			gapEnd += count;
+		}
+	}
+
+	// Grows geometrically so a run of inserts at the gap costs O(1) amortized each.
+	void reserveGap(size_t count) {
+		if (gapSize() >= count)
+			return;
+
+		const size_t tail = data.size() - gapEnd;
+		const size_t capacity = std::max(data.size() * 2, size() + count + MIN_GAP);
+		std::vector<T> grown(capacity);
+		std::move(data.begin(), data.begin() + gapStart, grown.begin());
+		std::move(data.begin() + gapEnd, data.end(), grown.end() - tail);
+		data = std::move(grown);
+		gapEnd = data.size() - tail;
+	}
+
+	std::vector<T> data;
+	size_t gapStart = 0;
+	size_t gapEnd = 0;
+};
+
+class PieceTable {
+public:
+	enum class Source : uint8_t { Original, Add, Adopted };
+
+	// A run of one of the table's buffers. The buffers only grow until the next assign(), so a
+	// piece taken out with copyPieces() stays valid and can be put back with insertPieces(); the
+	// undo history (text_undo.h) keeps deleted text that way instead of copying it.
+	struct Piece {
+		Source source;
+		uint32_t buffer; // index into adopted for Source::Adopted
+		size_t start;
+		size_t length;
+	};
+
+	static constexpr size_t CHUNK = 128; // pieces per chunk when a chunk is cut; cut at twice that
+
+	size_t size() const { return length; }
+	bool empty() const { return length == 0; }
+
+	char operator[](size_t i) const {
+		const Place at = locate(i);
+		const Piece& piece = chunks[at.chunk][at.piece];
+		return source(piece)[piece.start + (i - pieceStart)];
+	}
+
+	void insert(size_t pos, const char* text, size_t count) {
+		if (count == 0)
+			return;
+
+		const size_t addStart = add.size();
+		add.append(text, count);
+
+		// Typing at the end of the previous insert just extends that piece. Nothing before it
+		// moves, so the cached position stays valid.
+		if (pos > 0) {
+			const Place at = locate(pos - 1);
+			Piece& piece = chunks[at.chunk][at.piece];
+			if (piece.source == Source::Add && piece.start + piece.length == addStart && pieceStart + piece.length == pos) {
+				piece.length += count;
+				chunkLengths.set(at.chunk, chunkLengths.value(at.chunk) + count);
+				length += count;
+				return;
+			}
+		}
+
+		const Piece piece = { Source::Add, 0, addStart, count };
+		insertAt(split(pos), &piece, &piece + 1, count);
+	}
+
+	// Inserts without copying: the buffer becomes a source of its own and lives as long as the
+	// table (until the next assign()). Meant for large pastes and loads.
+	void adopt(size_t pos, OwnedText text, size_t count) {
+		if (count == 0)
+			return;
+
+		const Piece piece = { Source::Adopted, (uint32_t) adopted.size(), 0, count };
+		adopted.push_back(std::move(text));
+		insertAt(split(pos), &piece, &piece + 1, count);
+	}
+
+	void erase(size_t pos, size_t count) {
+		if (count == 0)
+			return;
+
+		// Splitting at the end second leaves the place of the start valid
+		const Place first = split(pos);
+		const Place last = split(pos + count);
+		std::vector<Piece>& firstChunk = chunks[first.chunk];
+		if (first.chunk == last.chunk) {
+			firstChunk.erase(firstChunk.begin() + first.piece, firstChunk.begin() + last.piece);
+			pieces -= last.piece - first.piece;
+			chunkLengths.set(first.chunk, chunkLengths.value(first.chunk) - count);
+		} else {
+			// The chunks in between empty and go in the refit
+			std::vector<Piece>& lastChunk = chunks[last.chunk];
+			pieces -= firstChunk.size() - first.piece + last.piece;
+			firstChunk.erase(firstChunk.begin() + first.piece, firstChunk.end());
+			lastChunk.erase(lastChunk.begin(), lastChunk.begin() + last.piece);
+			for (size_t c = first.chunk + 1; c < last.chunk; ++c) {
+				pieces -= chunks[c].size();
+				chunks[c].clear();
+			}
+			refit(first.chunk, last.chunk + 1);
+		}
+		length -= count;
+		if (chunks[first.chunk].empty() || chunks[first.chunk].size() > 2 * CHUNK)
+			refit(first.chunk, first.chunk + 1);
+		forget();
+	}
+
+	void assign(const char* text, size_t count) {
+		ownedOriginal.assign(text, count);
+		reset(ownedOriginal.data(), count, nullptr);
+	}
+
+	// Uses text as the original buffer without copying it; owner keeps it alive (and unchanged)
+	// until the next assign(). Opening a document this way is O(1) whatever its size.
+	void assignShared(const char* text, size_t count, std::shared_ptr<const void> owner) {
+		ownedOriginal.clear();
+		reset(text, count, std::move(owner));
+	}
+
+	// Copies a shared original into the table and releases its owner, for when the owner has to
+	// go away (e.g. a file mapping that blocks replacing the file).
+	void unshare() {
+		if (!originalOwner)
+			return;
+		ownedOriginal.assign(original, originalLength);
+		original = ownedOriginal.data();
+		originalOwner.reset();
+	}
+
+	void clear() { assign(nullptr, 0); }
+
+	void copyTo(size_t pos, size_t count, char* out) const {
+		forEachSpan(pos, count, [&](const char* span, size_t spanLength) {
+			out = std::copy(span, span + spanLength, out);
+		});
+	}
+
+	// Calls fn(const char* span, size_t length) for each contiguous run covering [pos, pos + count).
+	template <typename Fn>
+	void forEachSpan(size_t pos, size_t count, Fn&& fn) const {
+		copyPieces(pos, count, [&](const Piece& piece) { fn(source(piece) + piece.start, piece.length); });
+	}
+
+	// Calls fn(const Piece&) for the pieces covering [pos, pos + count), trimmed to the range.
+	template <typename Fn>
+	void copyPieces(size_t pos, size_t count, Fn&& fn) const {
+		if (count == 0)
+			return;
+
+		Place at = locate(pos);
+		size_t offset = pos - pieceStart;
+		while (count > 0) {
+			if (at.piece == chunks[at.chunk].size()) {
+				++at.chunk;
+				at.piece = 0;
+			}
+			Piece piece = chunks[at.chunk][at.piece++];
+			piece.start += offset;
+			piece.length = std::min(count, piece.length - offset);
+			fn(piece);
+			count -= piece.length;
+			offset = 0;
+		}
+	}
+
+	// Inserts pieces obtained from copyPieces() since the last assign().
+	template <typename It>
+	void insertPieces(size_t pos, It first, It last) {
+		size_t count = 0;
+		for (It it = first; it != last; ++it)
+			count += it->length;
+		if (count == 0)
+			return;
+
+		insertAt(split(pos), first, last, count);
+	}
+
+	size_t pieceCount() const { return pieces; }
+
+private:
+	// A piece by chunk and index within the chunk; piece may be the chunk's size, past its last piece
+	struct Place {
+		size_t chunk;
+		size_t piece;
+	};
+
+	void reset(const char* text, size_t count, std::shared_ptr<const void> owner) {
+		original = text;
+		originalLength = count;
+		originalOwner = std::move(owner);
+		add.clear();
+		adopted.clear();
+		chunks.assign(1, {});
+		if (count > 0)
+			chunks[0].push_back(Piece { Source::Original, 0, 0, count });
+		chunkLengths = FenwickTree<size_t>(1, count);
+		pieces = chunks[0].size();
+		length = count;
+		forget();
+	}
+
+	const char* source(const Piece& piece) const {
+		switch (piece.source) {
+			case Source::Original: return original;
+			case Source::Add: return add.data();
+			default: return adopted[piece.buffer].get();
+		}
+	}
+
+	// Piece containing character i (i < length), whose first character it leaves in pieceStart.
+	// The chunk comes from the length sums in O(log chunks), the piece from a walk within the
+	// chunk that starts at the last answer, so sequential access, which is what stb_textedit
+	// mostly does, is O(1).
+	Place locate(size_t i) const {
+		if (cachedChunk >= chunks.size() || i < chunkStart || i - chunkStart >= chunkLengths.value(cachedChunk)) {
+			cachedChunk = chunkLengths.find(i);
+			chunkStart = chunkLengths.prefix(cachedChunk);
+			cachedPiece = 0;
+			pieceStart = chunkStart;
+		}
+
+		const std::vector<Piece>& chunk = chunks[cachedChunk];
+		while (i < pieceStart)
+			pieceStart -= chunk[--cachedPiece].length;
+		while (i - pieceStart >= chunk[cachedPiece].length)
+			pieceStart += chunk[cachedPiece++].length;
+		return Place { cachedChunk, cachedPiece };
+	}
+
+	// Makes sure a piece boundary exists at pos and returns the place of the piece starting there,
+	// or the end of the last chunk for pos >= length. The chunk may end up one piece over its
+	// limit until the caller refits it.
+	Place split(size_t pos) {
+		if (pos >= length)
+			return Place { chunks.size() - 1, chunks.back().size() };
+
+		const Place at = locate(pos);
+		const size_t offset = pos - pieceStart;
+		if (offset == 0)
+			return at;
+
+		std::vector<Piece>& chunk = chunks[at.chunk];
+		Piece right = chunk[at.piece];
+		right.start += offset;
+		right.length -= offset;
+		chunk[at.piece].length = offset;
+		chunk.insert(chunk.begin() + at.piece + 1, right);
+		++pieces;
+		return Place { at.chunk, at.piece + 1 };
+	}
+
+	// Inserts the pieces [first, last), count characters in total, at place
+	template <typename It>
+	void insertAt(Place at, It first, It last, size_t count) {
+		std::vector<Piece>& chunk = chunks[at.chunk];
+		const size_t before = chunk.size();
+		chunk.insert(chunk.begin() + at.piece, first, last);
+		pieces += chunk.size() - before;
+		length += count;
+		if (chunk.size() > 2 * CHUNK)
+			refit(at.chunk, at.chunk + 1);
+		else
+			chunkLengths.set(at.chunk, chunkLengths.value(at.chunk) + count);
+		forget();
+	}
+
+	// Re-chunks chunks [first, last) after their pieces changed: empty chunks go (one always
+	// stays), chunks over 2 * CHUNK pieces are cut into CHUNK-piece chunks, and the length sums
+	// are rebuilt in O(chunks). Edits only get here when a chunk fills up or empties.
+	void refit(size_t first, size_t last) {
+		last = std::min(last, chunks.size());
+		std::vector<std::vector<Piece>> fitted;
+		std::vector<size_t> lengths;
+		for (size_t c = first; c < last; ++c) {
+			const std::vector<Piece>& chunk = chunks[c];
+			const size_t cut = chunk.size() > 2 * CHUNK ? CHUNK : chunk.size();
+			for (size_t p = 0; p < chunk.size(); p += cut) {
+				fitted.emplace_back(chunk.begin() + p, chunk.begin() + std::min(chunk.size(), p + cut));
+				size_t chunkLength = 0;
+				for (const Piece& piece : fitted.back())
+					chunkLength += piece.length;
+				lengths.push_back(chunkLength);
+			}
+		}
+		if (fitted.empty() && chunks.size() == last - first) {
+			fitted.emplace_back();
+			lengths.push_back(0);
+		}
+		chunks.erase(chunks.begin() + first, chunks.begin() + last);
+		chunks.insert(chunks.begin() + first, std::make_move_iterator(fitted.begin()), std::make_move_iterator(fitted.end()));
+		chunkLengths.replace(first, last, lengths.begin(), lengths.end());
+	}
+
+	void forget() {
+		cachedChunk = SIZE_MAX;
+	}
+
+	const char* original = "";
+	size_t originalLength = 0;
+	std::shared_ptr<const void> originalOwner;
+	std::string ownedOriginal;
+	std::string add;
+	std::vector<OwnedText> adopted;
+	std::vector<std::vector<Piece>> chunks = { {} }; // never empty; only a lone chunk has no pieces
+	FenwickTree<size_t> chunkLengths { 1 };          // characters per chunk
+	size_t pieces = 0;
+	size_t length = 0;
+
+	mutable size_t cachedChunk = SIZE_MAX; // last locate() answer, SIZE_MAX after an edit
+	mutable size_t chunkStart = 0;         // first character of cachedChunk
+	mutable size_t cachedPiece = 0;
+	mutable size_t pieceStart = 0;         // first character of cachedPiece
+};
+
+// The backend text_control uses, chosen at configure time (EDITING_TEXT_STORAGE in CMake).
+#if defined(TEXT_STORAGE_GAP_BUFFER)
+using text_storage = GapBuffer<char>;
+#else
+using text_storage = PieceTable;
+#endif
@@ -0,0 +1,180 @@
+// text_undo.h
+// Undo history for the piece table backend, replacing stb_textedit's fixed-size StbUndoState.
+//
+// A step records the text an edit removed and the text it inserted as piece table pieces, i.e.
+// references into buffers the table never overwrites, so undoing a cut of any size costs a few
+// piece descriptors instead of a copy of the characters. Consecutive typing and consecutive
+// deletes grow the open step until seal() is called; the editor seals on caret movement, clicks
+// and clipboard commands. Steps and pieces live in std::deque, which grows in fixed-size blocks
+// without moving what is already recorded; the blocks come from the block pool (pool_allocator.h),
+// so dropped redo steps and cleared histories are reused by the next edits of any text_control.
+// The deques are only allocated by the first edit, so a text_control that is never edited (most
+// fields of a form) carries one null pointer of history.
+
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <cstddef>
+
+#include "text_storage.h"
+#include "pool_allocator.h"
+
+class TextUndo {
+public:
+	using Piece = PieceTable::Piece;
+
+	// Where an undo or redo left the text: the changed range is [pos, pos + length).
+	struct Change {
+		size_t pos;
+		size_t length;
+	};
+
+	// Call after text.insert/adopt/insertPieces of count characters at pos.
+	void recordInsert(const PieceTable& text, size_t pos, size_t count) {
+		if (count == 0)
+			return;
+
+		Step* step = openStep();
+		if (!step || step->pos + step->insertedLength != pos)
+			step = beginStep(pos);
+		const size_t rangeStart = step->first + step->removedPieces;
+		text.copyPieces(pos, count, [&](const Piece& piece) { append(piece, rangeStart); });
+		step->insertedLength += count;
+		step->insertedPieces = history->pieces.size() - step->first - step->removedPieces;
+	}
+
+	// Call before text.erase of count characters at pos.
+	void recordDelete(const PieceTable& text, size_t pos, size_t count) {
+		if (count == 0)
+			return;
+
+		Step* step = openStep();
+		if (step && step->insertedLength == 0 && pos + count == step->pos) {
+			// Backspace: the removed text goes in front of what the step already holds
+			Pieces& pieces = history->pieces;
+			size_t at = step->first;
+			text.copyPieces(pos, count, [&](const Piece& piece) {
+				pieces.insert(pieces.begin() + at++, piece);
+			});
+			if (step->removedPieces > 0)
+				mergeWithPrevious(at);
+			step->pos = pos;
+		} else {
+			if (!step || step->insertedLength != 0 || pos != step->pos)
+				step = beginStep(pos);
+			text.copyPieces(pos, count, [&](const Piece& piece) { append(piece, step->first); });
+		}
+		step->removedLength += count;
+		step->removedPieces = history->pieces.size() - step->first;
+	}
+
+	// Ends the open step; the next edit starts a new one.
+	void seal() { open = false; }
+
+	void clear() {
+		history.reset();
+		current = 0;
+		open = false;
+	}
+
+	bool canUndo() const { return current > 0; }
+	bool canRedo() const { return current < stepCount(); }
+
+	// Reverts the last step through replace(pos, eraseCount, firstPiece, lastPiece), which has to
+	// erase eraseCount characters at pos and insert the pieces there without recording them.
+	template <typename Fn>
+	bool undo(Fn&& replace, Change* change = nullptr) {
+		if (!canUndo())
+			return false;
+		seal();
+		const Step& step = history->steps[--current];
+		const auto first = history->pieces.begin() + step.first;
+		replace(step.pos, step.insertedLength, first, first + step.removedPieces);
+		if (change)
+			*change = Change { step.pos, step.removedLength };
+		return true;
+	}
+
+	template <typename Fn>
+	bool redo(Fn&& replace, Change* change = nullptr) {
+		if (!canRedo())
+			return false;
+		seal();
+		const Step& step = history->steps[current++];
+		const auto first = history->pieces.begin() + step.first + step.removedPieces;
+		replace(step.pos, step.removedLength, first, first + step.insertedPieces);
+		if (change)
+			*change = Change { step.pos, step.insertedLength };
+		return true;
+	}
+
+	size_t stepCount() const { return history ? history->steps.size() : 0; }
+	size_t pieceCount() const { return history ? history->pieces.size() : 0; }
+
+private:
+	// pieces[first, first + removedPieces) held the removed text, the insertedPieces after them
+	// the inserted text.
+	struct Step {
+		size_t pos;
+		size_t removedLength;
+		size_t insertedLength;
+		size_t first;
+		size_t removedPieces;
+		size_t insertedPieces;
+	};
+
+	using Steps = std::deque<Step, PoolAllocator<Step>>;
+	using Pieces = std::deque<Piece, PoolAllocator<Piece>>;
+
+	struct History {
+		Steps steps;
+		Pieces pieces;
+	};
+
+	Step* openStep() {
+		return open && current == stepCount() && current > 0 ? &history->steps.back() : nullptr;
+	}
+
+	// Drops the redo steps and starts an empty step at pos.
+	Step* beginStep(size_t pos) {
+		if (!history)
+			history = std::make_unique<History>();
+		Steps& steps = history->steps;
+		if (current < steps.size()) {
+			history->pieces.resize(steps[current].first);
+			steps.resize(current);
+		}
+		steps.push_back(Step { pos, 0, 0, history->pieces.size(), 0, 0 });
+		current = steps.size();
+		open = true;
+		return &steps.back();
+	}
+
+	static bool continues(const Piece& before, const Piece& after) {
+		return before.source == after.source && before.buffer == after.buffer && before.start + before.length == after.start;
+	}
+
+	// Adds piece at the end, extending the last piece when it belongs to the range starting at
+	// rangeStart and continues into piece.
+	void append(const Piece& piece, size_t rangeStart) {
+		Pieces& pieces = history->pieces;
+		if (pieces.size() > rangeStart && continues(pieces.back(), piece))
+			pieces.back().length += piece.length;
+		else
+			pieces.push_back(piece);
+	}
+
+	// Joins pieces[at - 1] and pieces[at] when they are one run (repeated backspace).
+	void mergeWithPrevious(size_t at) {
+		Pieces& pieces = history->pieces;
+		if (continues(pieces[at - 1], pieces[at])) {
+			pieces[at - 1].length += pieces[at].length;
+			pieces.erase(pieces.begin() + at);
+		}
+	}
+
+	std::unique_ptr<History> history; // created by the first step
+	size_t current = 0; // steps[0, current) can be undone, the rest redone
+	bool open = false;
+};
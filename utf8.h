@@ -0,0 +1,417 @@
+// utf8.h
+// UTF-8 helpers for the text engine, which stores UTF-8 and addresses characters by codepoint.
+//
+//   utf8_*          - counting, validation, decoding and encoding, with ASCII fast paths that test
+//                     16 bytes (or 4 codepoints) at a time with SSE2/NEON. Everything but
+//                     utf8_valid and utf8_from_latin1 expects valid UTF-8; the storage keeps that
+//                     invariant (text_control only ever receives validated or encoded text), so a
+//                     codepoint boundary is simply a byte that is not a continuation byte and no
+//                     edit can merge or split a neighbouring codepoint.
+//   CodepointIndex  - codepoint position -> byte offset for a text storage in chunks of about
+//                     CHUNK codepoints. The chunks' codepoint and byte lengths are summed in
+//                     Fenwick trees, so an edit updates its own chunk's lengths and O(log chunks)
+//                     sums instead of every later chunk. A chunk that is all ASCII answers
+//                     directly; the others walk from the chunk start or from the last answer,
+//                     which makes stb_textedit's sequential STB_TEXTEDIT_GETCHAR calls O(1)
+//                     amortized.
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "fenwick_tree.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTF8_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define UTF8_NEON
+#include <arm_neon.h>
+#endif
+
+// Whether 16 bytes are all ASCII
+inline bool utf8_ascii16(const char* p) {
+#if defined(UTF8_SSE2)
+	return _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))) == 0;
+#elif defined(UTF8_NEON)
+	return vmaxvq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(p))) < 0x80;
+#else
+	for (int i = 0; i < 16; ++i) {
+		if (p[i] & 0x80)
+			return false;
+	}
+	return true;
+#endif
+}
+
+inline bool utf8_is_ascii(const char* text, size_t size) {
+	if (size < 16) {
+		for (size_t i = 0; i < size; ++i) {
+			if (text[i] & 0x80)
+				return false;
+		}
+		return true;
+	}
+	// The last block overlaps the one before it instead of a scalar tail
+	for (size_t i = 0; i + 16 < size; i += 16) {
+		if (!utf8_ascii16(text + i))
+			return false;
+	}
+	return utf8_ascii16(text + size - 16);
+}
+
+inline bool utf8_is_continuation(char byte) { return (byte & 0xc0) == 0x80; }
+
+// Bytes of the sequence a lead byte starts
+inline size_t utf8_sequence_length(char lead) {
+	const unsigned char byte = (unsigned char) lead;
+	return byte < 0x80 ? 1 : byte < 0xe0 ? 2 : byte < 0xf0 ? 3 : 4;
+}
+
+// Codepoints in size bytes, i.e. the bytes that are not continuation bytes
+inline size_t utf8_count(const char* text, size_t size) {
+	size_t count = 0, i = 0;
+#if defined(UTF8_SSE2)
+	const __m128i continuation = _mm_set1_epi8((char) 0xbf); // -65: 0x80-0xbf are the int8 values below it
+	for (; i + 16 <= size; i += 16) {
+		const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+		const int starts = _mm_movemask_epi8(_mm_cmpgt_epi8(bytes, continuation));
+#if defined(_MSC_VER) && !defined(__clang__)
+		count += __popcnt((unsigned) starts);
+#else
+		count += __builtin_popcount((unsigned) starts);
+#endif
+	}
+#elif defined(UTF8_NEON)
+	const int8x16_t continuation = vdupq_n_s8((int8_t) 0xbf);
+	for (; i + 16 <= size; i += 16) {
+		const uint8x16_t starts = vcgtq_s8(vld1q_s8(reinterpret_cast<const int8_t*>(text + i)), continuation);
+		count += vaddvq_u8(vshrq_n_u8(starts, 7));
+	}
+#endif
+	for (; i < size; ++i)
+		count += !utf8_is_continuation(text[i]);
+	return count;
+}
+
+// Decodes the codepoint at p and moves p past it
+inline char32_t utf8_decode(const char*& p) {
+	const unsigned char lead = (unsigned char) *p++;
+	if (lead < 0x80)
+		return lead;
+	const size_t length = utf8_sequence_length((char) lead);
+	char32_t codepoint = lead & (0x7f >> length);
+	for (size_t k = 1; k < length; ++k)
+		codepoint = (codepoint << 6) | ((unsigned char) *p++ & 0x3f);
+	return codepoint;
+}
+
+// Decodes size bytes into out (one entry per codepoint); returns the number of codepoints
+inline size_t utf8_decode(const char* text, size_t size, uint32_t* out) {
+	const char* p = text;
+	const char* const end = text + size;
+	uint32_t* const first = out;
+	while (p < end) {
+#if defined(UTF8_SSE2)
+		if (end - p >= 16 && utf8_ascii16(p)) {
+			// Widen 16 bytes to 16 codepoints
+			const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i low = _mm_unpacklo_epi8(bytes, zero), high = _mm_unpackhi_epi8(bytes, zero);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 0), _mm_unpacklo_epi16(low, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4), _mm_unpackhi_epi16(low, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm_unpacklo_epi16(high, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 12), _mm_unpackhi_epi16(high, zero));
+			p += 16;
+			out += 16;
+			continue;
+		}
+#endif
+		*out++ = utf8_decode(p);
+	}
+	return (size_t) (out - first);
+}
+
+// Encodes one codepoint (no surrogates, at most U+10FFFF) to out; returns the bytes written
+inline size_t utf8_encode(char32_t codepoint, char* out) {
+	if (codepoint < 0x80) {
+		out[0] = (char) codepoint;
+		return 1;
+	}
+	if (codepoint < 0x800) {
+		out[0] = (char) (0xc0 | (codepoint >> 6));
+		out[1] = (char) (0x80 | (codepoint & 0x3f));
+		return 2;
+	}
+	if (codepoint < 0x10000) {
+		out[0] = (char) (0xe0 | (codepoint >> 12));
+		out[1] = (char) (0x80 | ((codepoint >> 6) & 0x3f));
+		out[2] = (char) (0x80 | (codepoint & 0x3f));
+		return 3;
+	}
+	out[0] = (char) (0xf0 | (codepoint >> 18));
+	out[1] = (char) (0x80 | ((codepoint >> 12) & 0x3f));
+	out[2] = (char) (0x80 | ((codepoint >> 6) & 0x3f));
+	out[3] = (char) (0x80 | (codepoint & 0x3f));
+	return 4;
+}
+
+// Codepoints that cannot be encoded (surrogates, past U+10FFFF) become U+FFFD
+inline char32_t utf8_sanitize(char32_t codepoint) {
+	return codepoint > 0x10ffff || (codepoint >= 0xd800 && codepoint < 0xe000) ? 0xfffd : codepoint;
+}
+
+// Encodes count codepoints to out, which needs room for 4 bytes each; returns the bytes written
+inline size_t utf8_encode(const char32_t* codepoints, size_t count, char* out) {
+	char* const first = out;
+	size_t i = 0;
+#if defined(UTF8_SSE2)
+	// Eight ASCII codepoints narrowed to eight bytes
+	for (; i + 8 <= count; ) {
+		const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(codepoints + i));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(codepoints + i + 4));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_srli_epi32(_mm_or_si128(a, b), 7), _mm_setzero_si128())) != 0xffff)
+			break;
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_setzero_si128()));
+		out += 8;
+		i += 8;
+	}
+#endif
+	for (; i < count; ++i)
+		out += utf8_encode(utf8_sanitize(codepoints[i]), out);
+	return (size_t) (out - first);
+}
+
+// Length of a well-formed sequence at text[0, size) (RFC 3629: no overlongs, surrogates or
+// codepoints past U+10FFFF), or 0
+inline size_t utf8_valid_sequence(const unsigned char* text, size_t size) {
+	const unsigned char lead = text[0];
+	if (lead < 0x80)
+		return 1;
+	size_t length;
+	unsigned char low = 0x80, high = 0xbf; // allowed range of the second byte
+	if (lead >= 0xc2 && lead <= 0xdf) length = 2;
+	else if (lead == 0xe0) length = 3, low = 0xa0;
+	else if (lead == 0xed) length = 3, high = 0x9f;
+	else if (lead >= 0xe1 && lead <= 0xef) length = 3;
+	else if (lead == 0xf0) length = 4, low = 0x90;
+	else if (lead == 0xf4) length = 4, high = 0x8f;
+	else if (lead >= 0xf1 && lead <= 0xf3) length = 4;
+	else return 0;
+	if (size < length || text[1] < low || text[1] > high)
+		return 0;
+	for (size_t k = 2; k < length; ++k) {
+		if (!utf8_is_continuation((char) text[k]))
+			return 0;
+	}
+	return length;
+}
+
+inline bool utf8_valid(const char* text, size_t size) {
+	size_t i = 0;
+	while (i < size) {
+		if (size - i >= 16 && utf8_ascii16(text + i)) {
+			i += 16;
+			continue;
+		}
+		const size_t length = utf8_valid_sequence(reinterpret_cast<const unsigned char*>(text + i), size - i);
+		if (length == 0)
+			return false;
+		i += length;
+	}
+	return true;
+}
+
+// Reads text as Latin-1: out needs room for 2 bytes per input byte. Returns the bytes written.
+inline size_t utf8_from_latin1(const char* text, size_t size, char* out) {
+	char* const first = out;
+	for (size_t i = 0; i < size; ++i)
+		out += utf8_encode((unsigned char) text[i], out);
+	return (size_t) (out - first);
+}
+
+class CodepointIndex {
+public:
+	static constexpr size_t CHUNK = 1024; // codepoints per chunk when (re)built; split at twice that
+
+	size_t size() const { return codepoints; }
+
+	// Indexes the whole text
+	template <typename Text>
+	void build(const Text& text) {
+		splitPoints.clear();
+		codepoints = split(text, 0, 0, text.size(), splitPoints);
+		bytes = text.size();
+		replaceChunks(0, chunkCodepoints.size(), Point { 0, 0 }, Point { codepoints, bytes });
+		forget();
+	}
+
+	// Byte offset of codepoint pos (pos <= size())
+	template <typename Text>
+	size_t byteOf(const Text& text, size_t pos) const {
+		if (pos >= codepoints)
+			return bytes;
+		const size_t k = chunkOf(pos);
+		const Point first = chunkStart;
+		const Point last = { first.codepoint + chunkCodepoints.value(k), first.byte + chunkBytes.value(k) };
+		if (last.byte - first.byte == last.codepoint - first.codepoint)
+			return first.byte + (pos - first.codepoint);
+
+		// Step from the last answer if it is in this chunk and close, else from the chunk start
+		Point at = first;
+		if (cached.codepoint >= first.codepoint && cached.codepoint < last.codepoint) {
+			if (cached.codepoint <= pos)
+				at = cached;
+			else if (cached.codepoint - pos <= 16) {
+				at = cached;
+				while (at.codepoint > pos) {
+					--at.codepoint;
+					do --at.byte; while (utf8_is_continuation(text[at.byte]));
+				}
+			}
+		}
+		for (; at.codepoint < pos; ++at.codepoint)
+			at.byte += utf8_sequence_length(text[at.byte]);
+		cached = at;
+		return at.byte;
+	}
+
+	// Codepoint position of byte offset byte, which has to be on a codepoint boundary
+	template <typename Text>
+	size_t codepointOf(const Text& text, size_t byte) const {
+		if (byte >= bytes)
+			return codepoints;
+		const size_t k = chunkBytes.find(byte);
+		size_t count = chunkCodepoints.prefix(k);
+		const size_t first = chunkBytes.prefix(k);
+		text.forEachSpan(first, byte - first, [&](const char* span, size_t length) { count += utf8_count(span, length); });
+		return count;
+	}
+
+	// After count codepoints taking size bytes were inserted at codepoint pos
+	template <typename Text>
+	void inserted(const Text& text, size_t pos, size_t count, size_t size) {
+		const size_t k = pos < codepoints ? chunkOf(pos) : chunkCodepoints.size() - 1;
+		chunkCodepoints.set(k, chunkCodepoints.value(k) + count);
+		chunkBytes.set(k, chunkBytes.value(k) + size);
+		codepoints += count;
+		bytes += size;
+
+		if (chunkCodepoints.value(k) > 2 * CHUNK) {
+			const Point first = { chunkCodepoints.prefix(k), chunkBytes.prefix(k) };
+			splitPoints.clear();
+			split(text, first.codepoint, first.byte, chunkBytes.value(k), splitPoints);
+			replaceChunks(k, k + 1, first, Point { first.codepoint + chunkCodepoints.value(k), first.byte + chunkBytes.value(k) });
+		}
+		forget();
+	}
+
+	// After count codepoints taking size bytes were erased at codepoint pos. The chunks the erased
+	// codepoints spanned merge into one.
+	void erased(size_t pos, size_t count, size_t size) {
+		if (count == 0)
+			return;
+		const size_t first = chunkOf(pos);
+		const size_t last = chunkOf(pos + count - 1);
+		if (first == last) {
+			chunkCodepoints.set(first, chunkCodepoints.value(first) - count);
+			chunkBytes.set(first, chunkBytes.value(first) - size);
+		} else {
+			splitPoints.clear();
+			const Point start = { chunkCodepoints.prefix(first), chunkBytes.prefix(first) };
+			const Point end = { chunkCodepoints.prefix(last + 1) - count, chunkBytes.prefix(last + 1) - size };
+			replaceChunks(first, last + 1, start, end);
+		}
+		// An emptied chunk goes, but there is always one
+		if (chunkCodepoints.value(first) == 0 && chunkCodepoints.size() > 1) {
+			const size_t* none = nullptr;
+			chunkCodepoints.replace(first, first + 1, none, none);
+			chunkBytes.replace(first, first + 1, none, none);
+		}
+		codepoints -= count;
+		bytes -= size;
+		forget();
+	}
+
+private:
+	struct Point {
+		size_t codepoint;
+		size_t byte;
+	};
+
+	// Chunk containing codepoint pos (< codepoints), whose start it leaves in chunkStart; sequential
+	// lookups hit the same chunk
+	size_t chunkOf(size_t pos) const {
+		if (pos >= chunkStart.codepoint && pos - chunkStart.codepoint < chunkCodepoints.value(cachedChunk))
+			return cachedChunk;
+		cachedChunk = chunkCodepoints.find(pos);
+		chunkStart = { chunkCodepoints.prefix(cachedChunk), chunkBytes.prefix(cachedChunk) };
+		return cachedChunk;
+	}
+
+	// Appends a point every CHUNK codepoints of the size bytes at byte (codepoint pos), not counting
+	// the start itself. Returns the codepoint position at the end.
+	template <typename Text>
+	static size_t split(const Text& text, size_t pos, size_t byte, size_t size, std::vector<Point>& out) {
+		size_t next = pos + CHUNK;
+		text.forEachSpan(byte, size, [&](const char* span, size_t length) {
+			size_t i = 0;
+			while (i < length) {
+				// Whole ASCII blocks short of the next chunk start
+				if (length - i >= 16 && pos + 16 < next && utf8_ascii16(span + i)) {
+					pos += 16;
+					i += 16;
+					continue;
+				}
+				if (!utf8_is_continuation(span[i])) {
+					if (pos == next) {
+						out.push_back(Point { pos, byte + i });
+						next += CHUNK;
+					}
+					++pos;
+				}
+				++i;
+			}
+			byte += length;
+		});
+		return pos;
+	}
+
+	// Replaces chunks [first, last) by those from start through splitPoints to end
+	void replaceChunks(size_t first, size_t last, Point start, Point end) {
+		splitPoints.push_back(end);
+		lengths.clear();
+		Point at = start;
+		for (const Point& point : splitPoints) {
+			lengths.push_back(point.codepoint - at.codepoint);
+			at = point;
+		}
+		chunkCodepoints.replace(first, last, lengths.begin(), lengths.end());
+		lengths.clear();
+		at = start;
+		for (const Point& point : splitPoints) {
+			lengths.push_back(point.byte - at.byte);
+			at = point;
+		}
+		chunkBytes.replace(first, last, lengths.begin(), lengths.end());
+	}
+
+	void forget() {
+		cached = Point { 0, 0 };
+		cachedChunk = 0;
+		chunkStart = Point { 0, 0 };
+	}
+
+	FenwickTree<size_t> chunkCodepoints { 1 }; // length of every chunk, there is always one
+	FenwickTree<size_t> chunkBytes { 1 };
+	size_t codepoints = 0;
+	size_t bytes = 0;
+	std::vector<Point> splitPoints; // scratch of replaceChunks() and its callers
+	std::vector<size_t> lengths;
+	mutable Point cached = { 0, 0 }; // last byteOf answer
+	mutable size_t cachedChunk = 0;
+	mutable Point chunkStart = { 0, 0 }; // of cachedChunk
+};